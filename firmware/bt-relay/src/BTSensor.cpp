@@ -40,12 +40,14 @@ std::vector<BTSensor::Data> &BTSensor::data() {
   return data_;
 }
 
-BTSensor::Data::Data(uint32_t sid, uint32_t subid, double ts, double value)
-    : sid(sid), subid(subid), ts(ts), value(value) {}
+BTSensor::Data::Data(uint32_t sid, uint32_t subid, double ts, double value,
+                     int8_t rssi)
+    : sid(sid), subid(subid), ts(ts), value(value), rssi(rssi) {}
 
 std::string BTSensor::Data::ToJSON() const {
-  return shos::json::SPrintf("{sid: %u, subid: %u, ts: %.3f, v: %.1f}",
-                             (unsigned) sid, (unsigned) subid, ts, value);
+  return shos::json::SPrintf(
+      "{sid: %u, subid: %u, ts: %.3f, v: %.1f, rssi: %d}", (unsigned) sid,
+      (unsigned) subid, ts, value, rssi);
 }
 
 void BTSensor::UpdateCommon(int8_t rssi, uint32_t changed) {
@@ -58,7 +60,7 @@ void BTSensor::UpdateCommon(int8_t rssi, uint32_t changed) {
 }
 
 void BTSensor::ReportData(uint32_t subid, double value) {
-  data_.push_back(Data(sid_, subid, last_seen_ts_, value));
+  data_.push_back(Data(sid_, subid, last_seen_ts_, value, rssi_));
 }
 
 std::unique_ptr<BTSensor> CreateBTSensor(const shos::bt::Addr &addr,
@@ -23,8 +23,10 @@ class BTSensor {
     uint32_t subid = 0;
     double ts = 0;
     double value = 0;
+    // Of the advertisement, lets the hub pick the best relay.
+    int8_t rssi = 0;
 
-    Data(uint32_t sid, uint32_t subid, double ts, double value);
+    Data(uint32_t sid, uint32_t subid, double ts, double value, int8_t rssi);
     std::string ToJSON() const;
   };
 
@@ -1,11 +1,15 @@
 #include "hub_control.hpp"
 
 #include <math.h>
+#include <stdio.h>
+#include <string.h>
 #include <time.h>
 
+#include <algorithm>
 #include <memory>
 #include <set>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "mgos.hpp"
@@ -18,12 +22,25 @@
 #include "hub_control_limit.hpp"
 #include "hub_control_output.hpp"
 #include "hub_data.hpp"
+#include "hub_stats.hpp"
 
-#define NUM_LIMITS 30
-#define NUM_OUTPUTS 10
+// Number of limit and output entries in the config, see MigrateConfig().
+#define LEGACY_NUM_LIMITS 30
+#define LEGACY_NUM_OUTPUTS 10
+
+#define SET_LIMIT_ARGS_FMT                                              \
+  "{sid: %d, subid: %d, enable: %B, min: %lf, max: %lf, invert: %B, " \
+  "stale: %d, deps: %Q, out: %Q}"
+
+// Staleness windows are up to a few minutes, beyond that keys go around.
+#define STALE_WHEEL_SLOTS 512
+
+// Max time changes can wait to be saved, in seconds.
+#define CONTROL_SAVE_MAX_DELAY 60
 
 static bool s_heater_on = false;
 static double s_deadline = 0;
+static mgos_timer_id s_deadline_timer = MGOS_INVALID_TIMER_ID;
 
 static const char *onoff(bool on) {
   return (on ? "on" : "off");
@@ -31,13 +48,59 @@ static const char *onoff(bool on) {
 
 static Control *s_ctl = nullptr;
 
+static std::string cfg_str(const char *s) {
+  return (s != nullptr ? s : "");
+}
+
 Control::Control(struct mgos_config_hub_control *cfg)
-    : cfg_(cfg), eval_timer_(std::bind(&Control::Eval, this, false)) {
+    : cfg_(cfg),
+      stale_wheel_(STALE_WHEEL_SLOTS,
+                   [this](uint64_t i) {
+                     const Limit &l = limits_[i];
+                     EvalSensor(l.sid(), l.subid());
+                   }),
+      eval_timer_(std::bind(&Control::Eval, this)),
+      save_timer_(std::bind(&Control::Flush, this)) {
+  if (!Load()) {
+    MigrateConfig();
+    Save();
+  }
+
+  std::string error;
+  if (!Compile(true /* force */, &error)) {
+    LOG(LL_ERROR, ("Invalid limits: %s", error.c_str()));
+  }
+
+  // Limits are evaluated when their data changes or goes stale,
+  // periodic full evaluation is optional.
+  if (cfg_->eval_interval > 0) {
+    eval_timer_.Reset(cfg_->eval_interval * 1000, MGOS_TIMER_REPEAT);
+  }
+
+  if (!cfg_->enable) {
+    LOG(LL_INFO, ("Control is disabled"));
+  }
+}
+
+bool Control::IsEnabled() const {
+  return cfg_->enable;
+}
+
+void Control::SetEnabled(bool enable, const std::string &source) {
+  if (enable == cfg_->enable) return;
+  LOG(LL_INFO, ("Control %s -> %s (%s)", onoff(cfg_->enable), onoff(enable),
+                source.c_str()));
+  cfg_->enable = enable;
+  Eval();
+}
+
+// Limits and outputs used to be stored in the system config.
+void Control::MigrateConfig() {
 #define CASE(n)                                         \
   case n:                                               \
     ocfg = mgos_sys_config_get_hub_control_output##n(); \
     break;
-  for (int i = 0; i < NUM_OUTPUTS; i++) {
+  for (int i = 0; i < LEGACY_NUM_OUTPUTS; i++) {
     const struct mgos_config_hub_control_output *ocfg = nullptr;
     switch (i) {
       case 0:
@@ -54,11 +117,16 @@ Control::Control(struct mgos_config_hub_control *cfg)
         CASE(8)
         CASE(9)
     }
-    outputs_.push_back(
-        new Output(const_cast<struct mgos_config_hub_control_output *>(ocfg)));
+    if (ocfg->id < 0) continue;
+    OutputConfig oc;
+    oc.id = ocfg->id;
+    oc.name = cfg_str(ocfg->name);
+    oc.pin = ocfg->pin;
+    oc.act = ocfg->act;
+    outputs_.emplace_back(oc);
   }
 #undef CASE
-  for (int i = 0; i < NUM_LIMITS; i++) {
+  for (int i = 0; i < LEGACY_NUM_LIMITS; i++) {
     const struct mgos_config_hub_control_limit *lcfg = nullptr;
 #define CASE(n)                                        \
   case n:                                              \
@@ -100,34 +168,247 @@ Control::Control(struct mgos_config_hub_control *cfg)
         CASE(29)
     }
 #undef CASE
-    limits_.push_back(
-        new Limit(i, const_cast<struct mgos_config_hub_control_limit *>(lcfg)));
+    if (lcfg->sid < 0) continue;
+    // Entry number is the id, dependencies refer to it.
+    LimitConfig lc;
+    lc.sid = lcfg->sid;
+    lc.subid = lcfg->subid;
+    lc.enable = lcfg->enable;
+    lc.min = lcfg->min;
+    lc.max = lcfg->max;
+    lc.invert = lcfg->invert;
+    lc.deps = cfg_str(lcfg->deps);
+    lc.out = cfg_str(lcfg->out);
+    limits_.emplace_back(i, lc);
+  }
+  LOG(LL_INFO, ("Migrated %d limits and %d outputs from config",
+                (int) limits_.size(), (int) outputs_.size()));
+}
+
+bool Control::Load() {
+  const char *fn = mgos_sys_config_get_hub_control_file();
+  if (fn == nullptr) return false;
+  char *data = json_fread(fn);
+  if (data == nullptr) return false;
+  mgos::ScopedCPtr data_owner(data);
+  struct json_token lt = JSON_INVALID_TOKEN, ot = JSON_INVALID_TOKEN;
+  json_scanf(data, strlen(data), "{limits: %T, outputs: %T}", &lt, &ot);
+  if (lt.type != JSON_TYPE_ARRAY_END || ot.type != JSON_TYPE_ARRAY_END) {
+    // Do not migrate over it, it may be possible to fix it by hand.
+    LOG(LL_ERROR, ("%s: invalid file", fn));
+    return true;
+  }
+  struct json_token t;
+  for (int i = 0; json_scanf_array_elem(ot.ptr, ot.len, "", i, &t) > 0; i++) {
+    OutputConfig oc;
+    char *name = nullptr;
+    json_scanf(t.ptr, t.len, "{id: %d, name: %Q, pin: %d, act: %d}", &oc.id,
+               &name, &oc.pin, &oc.act);
+    mgos::ScopedCPtr name_owner(name);
+    oc.name = cfg_str(name);
+    outputs_.emplace_back(oc);
+  }
+  for (int i = 0; json_scanf_array_elem(lt.ptr, lt.len, "", i, &t) > 0; i++) {
+    int id = -1;
+    LimitConfig lc;
+    char *deps = nullptr, *out = nullptr;
+    json_scanf(t.ptr, t.len,
+               "{id: %d, sid: %d, subid: %d, enable: %B, min: %lf, max: %lf, "
+               "invert: %B, stale: %d, deps: %Q, out: %Q}",
+               &id, &lc.sid, &lc.subid, &lc.enable, &lc.min, &lc.max,
+               &lc.invert, &lc.stale, &deps, &out);
+    mgos::ScopedCPtr deps_owner(deps), out_owner(out);
+    if (id < 0) continue;
+    lc.deps = cfg_str(deps);
+    lc.out = cfg_str(out);
+    limits_.emplace_back(id, lc);
   }
+  LOG(LL_INFO, ("Loaded %d limits and %d outputs from %s",
+                (int) limits_.size(), (int) outputs_.size(), fn));
+  return true;
+}
 
-  eval_timer_.Reset(1000, MGOS_TIMER_REPEAT);
+bool Control::Save() {
+  const char *fn = mgos_sys_config_get_hub_control_file();
+  if (fn == nullptr) return true;
+  std::string data = "{\"limits\": [";
+  for (size_t i = 0; i < limits_.size(); i++) {
+    if (i > 0) data.append(", ");
+    limits_[i].ToJSON(&data);
+  }
+  data.append("], \"outputs\": [");
+  for (size_t i = 0; i < outputs_.size(); i++) {
+    if (i > 0) data.append(", ");
+    outputs_[i].ToJSON(&data);
+  }
+  data.append("]}\n");
+  std::string tmp_fn = mgos::SPrintf("%s.tmp", fn);
+  FILE *fp = fopen(tmp_fn.c_str(), "w");
+  if (fp == nullptr) return false;
+  bool ok = (fwrite(data.data(), data.size(), 1, fp) == 1);
+  ok = (fclose(fp) == 0 && ok);
+  if (!ok || rename(tmp_fn.c_str(), fn) != 0) {
+    LOG(LL_ERROR, ("Failed to write %s", fn));
+    remove(tmp_fn.c_str());
+    return false;
+  }
+  return true;
+}
 
-  if (!cfg_->enable) {
-    LOG(LL_INFO, ("Control is disabled"));
+// Schedules the tables to be saved once changes stop coming in.
+void Control::MarkDirty() {
+  double now = mgos_uptime();
+  if (!dirty_) {
+    dirty_ = true;
+    dirty_since_ = now;
   }
+  num_changes_++;
+  // Keep postponing while changes keep coming, but not indefinitely.
+  int delay_ms = cfg_->save_delay_ms;
+  int max_left_ms = (dirty_since_ + CONTROL_SAVE_MAX_DELAY - now) * 1000;
+  save_timer_.Reset(std::max(std::min(delay_ms, max_left_ms), 0), 0);
 }
 
-bool Control::IsEnabled() const {
-  return cfg_->enable;
+void Control::Flush() {
+  save_timer_.Clear();
+  if (!dirty_) return;
+  if (!Save()) {
+    save_timer_.Reset(cfg_->save_delay_ms, 0);
+    return;
+  }
+  LOG(LL_DEBUG, ("Saved limits (%u changes, %u saves)", num_changes_,
+                 num_saves_ + 1));
+  dirty_ = false;
+  num_saves_++;
+  HUB_COUNTER_INC(control_saves);
 }
 
-void Control::SetEnabled(bool enable, const std::string &source) {
-  if (enable == cfg_->enable) return;
-  LOG(LL_INFO, ("Control %s -> %s (%s)", onoff(cfg_->enable), onoff(enable),
-                source.c_str()));
-  cfg_->enable = enable;
-  Eval(true /* force */);
+// Recompiles and schedules saving of the tables after a change.
+// If the change creates a cycle, limits are reverted to old_limits, which
+// the graph and limit state still match.
+bool Control::ApplyChanges(std::vector<Limit> *old_limits,
+                           std::string *error) {
+  if (!Compile(false /* force */, error)) {
+    limits_.swap(*old_limits);
+    return false;
+  }
+  MarkDirty();
+  Eval();
+  return true;
+}
+
+int Control::GetNextLimitID() const {
+  int id = 0;
+  for (const Limit &l : limits_) {
+    id = std::max(id, l.id() + 1);
+  }
+  return id;
+}
+
+bool Control::Compile(bool force, std::string *error) {
+  LimitGraph graph;
+  const bool res = graph.Compile(limits_, outputs_, error);
+  if (!res && !force) return false;
+  graph_ = std::move(graph);
+  limits_raw_on_.Resize(limits_.size());
+  limits_on_.Resize(limits_.size());
+  // Indices may have changed, deadlines are set again on evaluation.
+  stale_wheel_.Clear();
+  return res;
+}
+
+// Re-evaluates the limit if eval is set, then checks its dependencies,
+// which have already been evaluated.
+void Control::EvalLimit(size_t i, bool eval, double now) {
+  Limit *l = &limits_[i];
+  if (eval) {
+    const struct SensorData *sd;
+    const uint8_t sensor_type = (l->sid() >> 24);
+    // For Xavax sensors, update thresholds from target temperature.
+    if (sensor_type == 1 && (sd = hub_get_data(l->sid(), 1)) != nullptr) {
+      double want_min = sd->value - 0.5, want_max = sd->value + 0.5;
+      if (l->min() != want_min || l->max() != want_max) {
+        LOG(LL_INFO, ("%d: SID %d: Updating thresholds to match TT %.1f",
+                      l->id(), l->sid(), sd->value));
+        l->set_min(want_min);
+        l->set_max(want_max);
+        MarkDirty();
+      }
+    }
+    // Same for BluTRV
+    if (sensor_type == 4 &&
+        (sd = hub_get_data(l->sid(), 0x4500)) != nullptr) {
+      double want_min = sd->value - 0.5, want_max = sd->value + 0.5;
+      if (l->min() != want_min || l->max() != want_max) {
+        LOG(LL_INFO, ("%d: SID %d: Updating thresholds to match TT %.1f",
+                      l->id(), l->sid(), sd->value));
+        l->set_min(want_min);
+        l->set_max(want_max);
+        MarkDirty();
+      }
+    }
+    limits_raw_on_.Set(i, l->Eval());
+    // Already stale data stays so, until new data triggers evaluation.
+    sd = hub_get_data(l->sid(), l->subid());
+    if (sd != nullptr && sd->ts + l->stale() > now) {
+      stale_wheel_.Schedule(i, sd->ts + l->stale());
+    } else {
+      stale_wheel_.Cancel(i);
+    }
+  }
+  bool want_on = limits_raw_on_.Test(i);
+  const Bitset &deps = graph_.node(i).deps;
+  if (want_on && deps.Intersects(limits_raw_on_)) {
+    for (size_t j = 0; j < limits_.size(); j++) {
+      if (!deps.Test(j) || !limits_raw_on_.Test(j)) continue;
+      LOG(LL_INFO, ("%d: Inhibited by %d", l->id(), limits_[j].id()));
+      break;
+    }
+    want_on = false;
+  }
+  if (want_on == limits_on_.Test(i)) return;
+  // Unchanged state is refreshed periodically, by ReportState().
+  limits_on_.Set(i, want_on);
+  ReportLimit(i, now);
+}
+
+void Control::ReportLimit(size_t i, double now) {
+  const Limit &l = limits_[i];
+  if (!l.IsValid() || !l.enable()) return;
+  report_to_server(mgos_sys_config_get_hub_lim_sid(), l.id(), now,
+                   limits_on_.Test(i));
+}
+
+void Control::UpdateOutputs(double now) {
+  const int64_t start = mgos_uptime_micros();
+  Bitset want_outputs_on;
+  want_outputs_on.Resize(outputs_.size());
+  for (size_t i = 0; i < limits_.size(); i++) {
+    if (limits_on_.Test(i)) want_outputs_on.Or(graph_.node(i).outputs);
+  }
+  for (size_t i = 0; i < outputs_.size(); i++) {
+    Output *o = &outputs_[i];
+    if (!o->IsValid()) continue;
+    bool want_on = want_outputs_on.Test(i);
+    bool is_on = o->GetState();
+    LOG(LL_DEBUG,
+        ("%d: is %s, want %s", o->id(), onoff(is_on), onoff(want_on)));
+    if (want_on == is_on) continue;
+    last_action_ts_ = now;
+    o->SetState(want_on);
+    const int64_t done = mgos_uptime_micros();
+    hub_stats_add_latency(HUB_LAT_ACT, done - start);
+    if (hub_stats_rx_micros() > 0) {
+      hub_stats_add_latency(HUB_LAT_TOTAL, done - hub_stats_rx_micros());
+    }
+  }
 }
 
-void Control::Eval(bool force) {
+void Control::Eval() {
   double now = cs_time();
-  std::set<Output *> want_outputs_on;
-  LOG(LL_DEBUG,
-      ("Eval %d %f %f %f", cfg_->enable, now, s_deadline, last_eval_));
+  // Reporting limit and output state adds data, which comes back here.
+  if (in_eval_) return;
+  LOG(LL_DEBUG, ("Eval %d %f %f", cfg_->enable, now, s_deadline));
   if (cfg_->enable) {
     if (s_deadline > 0 && s_deadline < now) {
       LOG(LL_INFO, ("Deadline expired"));
@@ -135,117 +416,102 @@ void Control::Eval(bool force) {
       s_deadline = 0;
     }
     if (s_deadline != 0) return;  // Heater is under manual control.
-    if (now - last_eval_ < cfg_->eval_interval && !force) return;
-    for (Limit *l : limits_) {
-      struct SensorData sd;
-      const uint8_t sensor_type = (l->sid() >> 24);
-      // For Xavax sensors, update thresholds from target temperature.
-      if (sensor_type == 1 && hub_get_data(l->sid(), 1, &sd)) {
-        double want_min = sd.value - 0.5, want_max = sd.value + 0.5;
-        if (l->min() != want_min || l->max() != want_max) {
-          LOG(LL_INFO, ("%d: SID %d: Updating thresholds to match TT %.1f",
-                        l->id(), l->sid(), sd.value));
-          l->set_min(want_min);
-          l->set_max(want_max);
-          mgos_sys_config_save(&mgos_sys_config, false /* try_once */, nullptr);
-        }
-      }
-      // Same for BluTRV
-      if (sensor_type == 4 && hub_get_data(l->sid(), 0x4500, &sd)) {
-        double want_min = sd.value - 0.5, want_max = sd.value + 0.5;
-        if (l->min() != want_min || l->max() != want_max) {
-          LOG(LL_INFO, ("%d: SID %d: Updating thresholds to match TT %.1f",
-                        l->id(), l->sid(), sd.value));
-          l->set_min(want_min);
-          l->set_max(want_max);
-          mgos_sys_config_save(&mgos_sys_config, false /* try_once */, nullptr);
-        }
-      }
-      bool want_on = l->Eval();
-      if (want_on) {
-        for (const std::string &id : l->deps()) {
-          Limit *dl = GetLimitByID(id);
-          if (dl == nullptr) {
-            LOG(LL_ERROR, ("Invalid dependency %s", id.c_str()));
-            continue;
-          }
-          if (dl->Eval(true /* quiet */)) {
-            LOG(LL_INFO,
-                ("%d: Inhibited by %s", l->id(), dl->ToString().c_str()));
-            want_on = false;
-            break;
-          }
-        }
-      }
-      if (want_on) {
-        for (const std::string &name_or_id : l->outputs()) {
-          Output *o = GetOutputByNameOrID(name_or_id);
-          if (o != nullptr) {
-            std::string n = o->name();
-            LOG(LL_DEBUG,
-                ("Want on: %d/%d -> %s", l->sid(), l->subid(), n.c_str()));
-            want_outputs_on.insert(o);
-          } else {
-            LOG(LL_ERROR, ("Failed to find output %s (limit %d/%d)",
-                           name_or_id.c_str(), l->sid(), l->subid()));
-          }
-        }
-      }
-      if (l->IsValid() && l->enable()) {
-        report_to_server(mgos_sys_config_get_hub_lim_sid(), l->id(), now,
-                         want_on);
-      }
+    const int64_t start = mgos_uptime_micros();
+    in_eval_ = true;
+    for (size_t i : graph_.order()) {
+      EvalLimit(i, true /* eval */, now);
     }
+    HUB_COUNTER_INC(eval_passes);
+    HUB_COUNTER_ADD(eval_micros, mgos_uptime_micros() - start);
   } else {
     LOG(LL_DEBUG, ("Control is disabled"));
+    in_eval_ = true;
+    limits_raw_on_.Clear();
+    limits_on_.Clear();
   }
-  for (Output *o : outputs_) {
-    if (!o->IsValid()) continue;
-    bool want_on = (want_outputs_on.find(o) != want_outputs_on.end());
-    bool is_on = o->GetState();
-    std::string n = o->name();
-    LOG(LL_DEBUG,
-        ("%s: is %s, want %s", n.c_str(), onoff(is_on), onoff(want_on)));
-    if (want_on != is_on) {
-      last_action_ts_ = now;
-    }
-    o->SetState(want_on);
+  UpdateOutputs(now);
+  in_eval_ = false;
+}
+
+void Control::EvalSensor(int sid, int subid) {
+  if (in_eval_ || !cfg_->enable || s_deadline != 0) return;
+  const auto *steps = graph_.GetSteps(SensorData::MakeKey(sid, subid));
+  if (steps == nullptr) return;
+  double now = cs_time();
+  const int64_t start = mgos_uptime_micros();
+  if (hub_stats_rx_micros() > 0) {
+    hub_stats_add_latency(HUB_LAT_QUEUE, start - hub_stats_rx_micros());
+  }
+  in_eval_ = true;
+  for (const LimitGraph::Step &step : *steps) {
+    EvalLimit(step.limit, step.eval, now);
+  }
+  const int64_t micros = mgos_uptime_micros() - start;
+  hub_stats_add_latency(HUB_LAT_EVAL, micros);
+  HUB_COUNTER_INC(eval_passes);
+  HUB_COUNTER_ADD(eval_micros, micros);
+  UpdateOutputs(now);
+  in_eval_ = false;
+}
+
+void Control::Metrics(struct mbuf *out) const {
+  hub_stats_prom_header(out, "hub_control_enabled", "gauge",
+                        "Whether control logic is enabled.");
+  hub_stats_prom_printf(out, "hub_control_enabled %d\n", cfg_->enable);
+  hub_stats_prom_header(out, "hub_limit_on", "gauge",
+                        "Whether the limit wants its outputs on.");
+  for (size_t i = 0; i < limits_.size(); i++) {
+    const Limit &l = limits_[i];
+    if (!l.IsValid() || !l.enable()) continue;
+    hub_stats_prom_printf(
+        out, "hub_limit_on{id=\"%d\",sid=\"%d\",subid=\"%d\"} %d\n",
+        l.id(), l.sid(), l.subid(), limits_on_.Test(i));
+  }
+  hub_stats_prom_header(out, "hub_output_on", "gauge",
+                        "Whether the output is on.");
+  for (const Output &o : outputs_) {
+    if (!o.IsValid()) continue;
+    const std::string name = hub_stats_prom_escape(o.name().c_str());
+    hub_stats_prom_printf(out, "hub_output_on{id=\"%d\",name=\"%s\"} %d\n",
+                          o.id(), name.c_str(), o.GetState());
   }
-  last_eval_ = now;
 }
 
 bool Control::GetOutputStatus(const std::string &name_or_id, bool *on,
                               double *last_change) {
-  const Output *o = GetOutputByNameOrID(name_or_id);
-  if (o == nullptr || !o->IsValid()) return false;
-  bool is_on = o->GetStateWithTimestamp(last_change);
+  int i = FindOutput(name_or_id);
+  if (i < 0) return false;
+  bool is_on = outputs_[i].GetStateWithTimestamp(last_change);
   *on = is_on;
   return true;
 }
 
-void Control::ReportOutputs() {
-  for (Output *o : outputs_) {
-    o->Report();
+void Control::ReportState() {
+  const double now = cs_time();
+  for (size_t i = 0; i < limits_.size(); i++) {
+    ReportLimit(i, now);
+  }
+  for (Output &o : outputs_) {
+    o.Report();
   }
 }
 
-Limit *Control::GetLimitByID(const std::string &id) const {
-  for (Limit *l : limits_) {
-    if (std::to_string(l->id()) == id) {
-      return l;
-    }
+int Control::FindLimit(const std::string &id) const {
+  for (size_t i = 0; i < limits_.size(); i++) {
+    if (std::to_string(limits_[i].id()) == id) return i;
   }
-  return nullptr;
+  return -1;
 }
 
-Output *Control::GetOutputByNameOrID(const std::string &name_or_id) const {
-  for (Output *o : outputs_) {
-    if (!o->IsValid()) continue;
-    if (o->name() == name_or_id || std::to_string(o->id()) == name_or_id) {
-      return o;
+int Control::FindOutput(const std::string &name_or_id) const {
+  for (size_t i = 0; i < outputs_.size(); i++) {
+    const Output &o = outputs_[i];
+    if (!o.IsValid()) continue;
+    if (o.name() == name_or_id || std::to_string(o.id()) == name_or_id) {
+      return i;
     }
   }
-  return nullptr;
+  return -1;
 }
 
 static void hub_heater_get_status_handler(struct mg_rpc_request_info *ri,
@@ -264,6 +530,15 @@ static void hub_heater_get_status_handler(struct mg_rpc_request_info *ri,
   (void) fi;
 }
 
+static void heater_deadline_timer_cb(void *arg UNUSED_ARG) {
+  s_deadline_timer = MGOS_INVALID_TIMER_ID;
+  if (s_deadline == 0) return;
+  LOG(LL_INFO, ("Deadline expired"));
+  s_heater_on = false;
+  s_deadline = 0;
+  s_ctl->Eval();
+}
+
 static void hub_heater_set_handler(struct mg_rpc_request_info *ri, void *cb_arg,
                                    struct mg_rpc_frame_info *fi,
                                    struct mg_str args) {
@@ -297,12 +572,15 @@ static void hub_heater_set_handler(struct mg_rpc_request_info *ri, void *cb_arg,
 
     double now = cs_time();
     s_deadline = now + duration;
+    mgos_clear_timer(s_deadline_timer);
+    s_deadline_timer =
+        mgos_set_timer(duration * 1000, 0, heater_deadline_timer_cb, nullptr);
   }
 
   mg_rpc_send_responsef(ri, "{ctl_on: %B, heater_on: %B, deadline: %.3lf}",
                         s_ctl->IsEnabled(), s_heater_on, s_deadline);
 
-  s_ctl->Eval(true /* force */);
+  s_ctl->Eval();
 
 out:
   (void) cb_arg;
@@ -320,116 +598,181 @@ void Control::GetLimitsRPCHandler(struct mg_rpc_request_info *ri, void *cb_arg,
 
   std::string res = "[";
   bool first = true;
-  for (const Limit *l : ctl->limits_) {
-    if (l->sid() < 0 || l->subid() < 0) continue;
-    if (sid >= 0 && l->sid() != sid) continue;
-    if (subid >= 0 && l->subid() != subid) continue;
+  for (const Limit &l : ctl->limits_) {
+    if (l.sid() < 0 || l.subid() < 0) continue;
+    if (sid >= 0 && l.sid() != sid) continue;
+    if (subid >= 0 && l.subid() != subid) continue;
     if (!first) res.append(", ");
-    mgos::JSONAppendStringf(&res,
-                            "{id: %d, sid: %d, subid: %d, enable: %B, "
-                            "min: %.2lf, max: %.2lf, invert: %B, "
-                            "deps: %Q, out: %Q}",
-                            l->id(), l->sid(), l->subid(), l->enable(),
-                            l->min(), l->max(), l->invert(),
-                            l->DepsStr().c_str(), l->OutStr().c_str());
+    l.ToJSON(&res);
     first = false;
   }
   res.append("]");
   mg_rpc_send_responsef(ri, "%s", res.c_str());
 }
 
-// static
-void Control::SetLimitRPCHandler(struct mg_rpc_request_info *ri, void *cb_arg,
-                                 struct mg_rpc_frame_info *fi,
-                                 struct mg_str args) {
-  Control *ctl = static_cast<Control *>(cb_arg);
-  char *msg = nullptr;
+// Updates the entry for the sensor or adds a new one, as specified by the
+// JSON object (same as Hub.Control.SetLimit args).
+// Limits are validated but not compiled, the caller must do that.
+bool Control::UpdateLimit(struct mg_str args, int *id, std::string *error) {
   int8_t enable = -1, invert = -1;
-  int sid = -1, subid = 0;
+  int sid = -1, subid = 0, stale = -1;
   double min = NAN, max = NAN;
   char *deps_s = nullptr, *out_s = nullptr;
 
-  json_scanf(args.p, args.len, ri->args_fmt, &sid, &subid, &enable, &min, &max,
-             &invert, &deps_s, &out_s);
+  json_scanf(args.p, args.len, SET_LIMIT_ARGS_FMT, &sid, &subid, &enable, &min,
+             &max, &invert, &stale, &deps_s, &out_s);
 
   mgos::ScopedCPtr deps_owner(deps_s), out_owner(out_s);
 
   if (sid < 0) {
-    mg_rpc_send_errorf(ri, -1, "sid is required");
-    return;
+    *error = "sid is required";
+    return false;
   }
 
-  // Try to find an existing entry for this sensor first.
-  Limit *l = nullptr;
-  for (Limit *li : ctl->limits_) {
-    if (li->sid() == sid && li->subid() == subid) {
-      l = li;
-      break;
-    }
+  int i = 0, n = limits_.size();
+  while (i < n && (limits_[i].sid() != sid || limits_[i].subid() != subid)) {
+    i++;
   }
-  // If not found, find an unused/invalid entry.
-  if (l == nullptr) {
-    for (Limit *li : ctl->limits_) {
-      if (!li->IsValid()) {
-        l = li;
-        break;
-      }
-    }
-  }
-  // If no unused entries, find a disabled one.
-  if (l == nullptr) {
-    for (Limit *li : ctl->limits_) {
-      if (!li->enable()) {
-        l = li;
-        break;
-      }
-    }
-  }
-  if (l == nullptr) {
-    mg_rpc_send_errorf(ri, -2, "no available entries");
-    return;
+  LimitConfig lc;
+  if (i < n) {
+    lc = limits_[i].cfg();
+  } else {
+    lc.sid = sid;
+    lc.subid = subid;
   }
 
   if (deps_s != nullptr) {
     for (const std::string &id : Limit::ParseCommaStr(deps_s)) {
-      Limit *l = ctl->GetLimitByID(id);
-      if (l == nullptr) {
-        mg_rpc_send_errorf(ri, -1, "invalid limit %s", id.c_str());
-        return;
+      if (FindLimit(id) < 0) {
+        *error = mgos::SPrintf("invalid limit %s", id.c_str());
+        return false;
       }
     }
-    l->set_deps(deps_s);
+    lc.deps = deps_s;
   }
 
   if (out_s != nullptr) {
     for (const std::string &name_or_id : Limit::ParseCommaStr(out_s)) {
-      Output *o = ctl->GetOutputByNameOrID(name_or_id);
-      if (o == nullptr) {
-        mg_rpc_send_errorf(ri, -1, "invalid output %s", name_or_id.c_str());
-        return;
+      if (FindOutput(name_or_id) < 0) {
+        *error = mgos::SPrintf("invalid output %s", name_or_id.c_str());
+        return false;
       }
     }
-    l->set_out(out_s);
-  }
-  l->set_sid(sid);
-  l->set_subid(subid);
-  if (enable != -1) l->set_enable(enable);
-  if (!isnan(min)) l->set_min(min);
-  if (!isnan(max)) l->set_max(max);
-  if (invert != -1) l->set_invert(invert);
-  LOG(LL_INFO, ("Modified limit: %s", l->ToString().c_str()));
-
-  if (!mgos_sys_config_save(&mgos_sys_config, false /* try_once */, &msg)) {
-    mg_rpc_send_errorf(ri, -1, "error saving config: %s", (msg ? msg : ""));
-    free(msg);
+    lc.out = out_s;
+  }
+  if (enable != -1) lc.enable = enable;
+  if (!isnan(min)) lc.min = min;
+  if (!isnan(max)) lc.max = max;
+  if (invert != -1) lc.invert = invert;
+  if (stale > 0) lc.stale = stale;
+
+  if (i < n) {
+    limits_[i].set_cfg(lc);
+  } else {
+    limits_.emplace_back(GetNextLimitID(), lc);
+  }
+  LOG(LL_INFO, ("Modified limit: %s", limits_[i].ToString().c_str()));
+  *id = limits_[i].id();
+  return true;
+}
+
+// static
+void Control::SetLimitRPCHandler(struct mg_rpc_request_info *ri, void *cb_arg,
+                                 struct mg_rpc_frame_info *fi UNUSED_ARG,
+                                 struct mg_str args) {
+  Control *ctl = static_cast<Control *>(cb_arg);
+  std::vector<Limit> old_limits = ctl->limits_;
+  std::string error;
+  int id = -1;
+  if (!ctl->UpdateLimit(args, &id, &error) ||
+      !ctl->ApplyChanges(&old_limits, &error)) {
+    mg_rpc_send_errorf(ri, -1, "%s", error.c_str());
+    return;
+  }
+  mg_rpc_send_responsef(ri, "{id: %d}", id);
+}
+
+// Applies all the changes or none at all.
+// static
+void Control::SetLimitsRPCHandler(struct mg_rpc_request_info *ri, void *cb_arg,
+                                  struct mg_rpc_frame_info *fi UNUSED_ARG,
+                                  struct mg_str args) {
+  Control *ctl = static_cast<Control *>(cb_arg);
+  struct json_token limits = JSON_INVALID_TOKEN;
+  json_scanf(args.p, args.len, ri->args_fmt, &limits);
+  if (limits.type != JSON_TYPE_ARRAY_END) {
+    mg_rpc_send_errorf(ri, -3, "limits is required and must be an array");
+    return;
+  }
+
+  std::vector<Limit> old_limits = ctl->limits_;
+  std::string error, ids;
+  struct json_token t;
+  for (int i = 0; json_scanf_array_elem(limits.ptr, limits.len, "", i, &t) > 0;
+       i++) {
+    int id = -1;
+    if (!ctl->UpdateLimit(mg_mk_str_n(t.ptr, t.len), &id, &error)) {
+      // Graph has not been recompiled yet, it matches the old limits.
+      ctl->limits_.swap(old_limits);
+      mg_rpc_send_errorf(ri, -1, "limits[%d]: %s", i, error.c_str());
+      return;
+    }
+    if (!ids.empty()) ids.append(", ");
+    ids.append(std::to_string(id));
+  }
+
+  if (!ctl->ApplyChanges(&old_limits, &error)) {
+    mg_rpc_send_errorf(ri, -1, "%s", error.c_str());
+    return;
+  }
+
+  mg_rpc_send_responsef(ri, "{ids: [%s]}", ids.c_str());
+}
+
+// static
+void Control::RemoveLimitRPCHandler(struct mg_rpc_request_info *ri,
+                                    void *cb_arg,
+                                    struct mg_rpc_frame_info *fi UNUSED_ARG,
+                                    struct mg_str args) {
+  Control *ctl = static_cast<Control *>(cb_arg);
+  int id = -1;
+
+  json_scanf(args.p, args.len, ri->args_fmt, &id);
+
+  const std::string id_s = std::to_string(id);
+  int i = ctl->FindLimit(id_s);
+  if (i < 0) {
+    mg_rpc_send_errorf(ri, 404, "no limit %d", id);
     return;
   }
+  for (const Limit &l : ctl->limits_) {
+    if (l.deps().count(id_s) > 0) {
+      mg_rpc_send_errorf(ri, -2, "limit %d depends on it", l.id());
+      return;
+    }
+  }
+
+  LOG(LL_INFO, ("Removed limit: %s", ctl->limits_[i].ToString().c_str()));
+  std::vector<Limit> old_limits = ctl->limits_;
+  ctl->limits_.erase(ctl->limits_.begin() + i);
 
-  ctl->Eval(true /* force */);
+  std::string error;
+  if (!ctl->ApplyChanges(&old_limits, &error)) {
+    mg_rpc_send_errorf(ri, -1, "%s", error.c_str());
+    return;
+  }
 
   mg_rpc_send_responsef(ri, nullptr);
+}
 
-  (void) fi;
+// Returns a limit that drives the output or nullptr.
+const Limit *Control::GetOutputUser(const Output &o) const {
+  const std::string id_s = std::to_string(o.id());
+  for (const Limit &l : limits_) {
+    const std::set<std::string> outs = l.outputs();
+    if (outs.count(o.name()) > 0 || outs.count(id_s) > 0) return &l;
+  }
+  return nullptr;
 }
 
 // static
@@ -442,23 +785,22 @@ void Control::GetOutputsRPCHandler(struct mg_rpc_request_info *ri, void *cb_arg,
 
   json_scanf(args.p, args.len, ri->args_fmt, &id, &name_s);
 
-  std::unique_ptr<char> name_owner(name_s);
+  mgos::ScopedCPtr name_owner(name_s);
   std::string name(name_s ? name_s : "");
 
   std::string res = "[";
   bool first = true;
-  for (const Output *o : ctl->outputs_) {
-    if (!o->IsValid()) continue;
-    if (id >= 0 && o->id() != id) continue;
-    if (name.length() > 0 && o->name() != name) continue;
+  for (const Output &o : ctl->outputs_) {
+    if (!o.IsValid()) continue;
+    if (id >= 0 && o.id() != id) continue;
+    if (name.length() > 0 && o.name() != name) continue;
 
-    const std::string &n = o->name();
-    const std::string &pin_name = o->pin_name();
+    const std::string &pin_name = o.pin_name();
     if (!first) res.append(", ");
     mgos::JSONAppendStringf(
         &res, "{id: %d, name: %Q, pin: %d, pin_name: %Q, act: %d, on: %B}",
-        o->id(), n.c_str(), o->pin(), pin_name.c_str(), o->act(),
-        o->GetState());
+        o.id(), o.name().c_str(), o.pin(), pin_name.c_str(), o.act(),
+        o.GetState());
     first = false;
   }
 
@@ -466,6 +808,97 @@ void Control::GetOutputsRPCHandler(struct mg_rpc_request_info *ri, void *cb_arg,
   mg_rpc_send_responsef(ri, "%s", res.c_str());
 }
 
+// static
+void Control::SetOutputRPCHandler(struct mg_rpc_request_info *ri, void *cb_arg,
+                                  struct mg_rpc_frame_info *fi UNUSED_ARG,
+                                  struct mg_str args) {
+  Control *ctl = static_cast<Control *>(cb_arg);
+  int id = -1, pin = -1, act = -1;
+  char *name_s = nullptr;
+
+  json_scanf(args.p, args.len, ri->args_fmt, &id, &name_s, &pin, &act);
+
+  mgos::ScopedCPtr name_owner(name_s);
+
+  if (id < 0) {
+    mg_rpc_send_errorf(ri, -1, "id is required");
+    return;
+  }
+
+  int i = 0, n = ctl->outputs_.size();
+  while (i < n && ctl->outputs_[i].id() != id) i++;
+  OutputConfig oc;
+  if (i < n) {
+    oc = ctl->outputs_[i].cfg();
+  } else {
+    oc.id = id;
+  }
+  if (name_s != nullptr) oc.name = name_s;
+  if (pin >= 0) oc.pin = pin;
+  if (act >= 0) oc.act = act;
+  if (oc.name.empty() || oc.pin < 0) {
+    mg_rpc_send_errorf(ri, -1, "name and pin are required");
+    return;
+  }
+  if (i < n && oc.name != ctl->outputs_[i].name()) {
+    const Limit *l = ctl->GetOutputUser(ctl->outputs_[i]);
+    if (l != nullptr) {
+      mg_rpc_send_errorf(ri, -2, "output is used by limit %d", l->id());
+      return;
+    }
+  }
+
+  if (i < n) {
+    ctl->outputs_[i].set_cfg(oc);
+  } else {
+    ctl->outputs_.emplace_back(oc);
+  }
+
+  std::vector<Limit> old_limits = ctl->limits_;
+  std::string error;
+  if (!ctl->ApplyChanges(&old_limits, &error)) {
+    mg_rpc_send_errorf(ri, -1, "%s", error.c_str());
+    return;
+  }
+
+  mg_rpc_send_responsef(ri, nullptr);
+}
+
+// static
+void Control::RemoveOutputRPCHandler(struct mg_rpc_request_info *ri,
+                                     void *cb_arg,
+                                     struct mg_rpc_frame_info *fi UNUSED_ARG,
+                                     struct mg_str args) {
+  Control *ctl = static_cast<Control *>(cb_arg);
+  int id = -1;
+
+  json_scanf(args.p, args.len, ri->args_fmt, &id);
+
+  int i = 0, n = ctl->outputs_.size();
+  while (i < n && ctl->outputs_[i].id() != id) i++;
+  if (i == n) {
+    mg_rpc_send_errorf(ri, 404, "no output %d", id);
+    return;
+  }
+  const Limit *l = ctl->GetOutputUser(ctl->outputs_[i]);
+  if (l != nullptr) {
+    mg_rpc_send_errorf(ri, -2, "output is used by limit %d", l->id());
+    return;
+  }
+
+  ctl->outputs_[i].SetState(false);
+  ctl->outputs_.erase(ctl->outputs_.begin() + i);
+
+  std::vector<Limit> old_limits = ctl->limits_;
+  std::string error;
+  if (!ctl->ApplyChanges(&old_limits, &error)) {
+    mg_rpc_send_errorf(ri, -1, "%s", error.c_str());
+    return;
+  }
+
+  mg_rpc_send_responsef(ri, nullptr);
+}
+
 static void heater_crontab_cb(struct mg_str action, struct mg_str payload,
                               void *userdata) {
 #if 0  // TODO
@@ -495,8 +928,36 @@ static void ctl_crontab_cb(struct mg_str action, struct mg_str payload,
   (void) action;
 }
 
-void HubControlReportOutputs() {
-  if (s_ctl != nullptr) s_ctl->ReportOutputs();
+static void hub_control_data_cb(int ev UNUSED_ARG, void *ev_data,
+                                void *userdata) {
+  const struct SensorData *sd = static_cast<struct SensorData *>(ev_data);
+  static_cast<Control *>(userdata)->EvalSensor(sd->sid, sd->subid);
+}
+
+static void hub_control_reboot_cb(int ev UNUSED_ARG, void *ev_data UNUSED_ARG,
+                                  void *userdata) {
+  static_cast<Control *>(userdata)->Flush();
+}
+
+// static
+void Control::StatusRPCHandler(struct mg_rpc_request_info *ri, void *cb_arg,
+                               struct mg_rpc_frame_info *fi UNUSED_ARG,
+                               struct mg_str args UNUSED_ARG) {
+  Control *ctl = static_cast<Control *>(cb_arg);
+  mg_rpc_send_responsef(ri,
+                        "{enable: %B, limits: %d, outputs: %d, dirty: %B, "
+                        "changes: %u, saves: %u}",
+                        ctl->IsEnabled(), (int) ctl->limits_.size(),
+                        (int) ctl->outputs_.size(), ctl->dirty_,
+                        ctl->num_changes_, ctl->num_saves_);
+}
+
+void HubControlMetrics(struct mbuf *out) {
+  if (s_ctl != nullptr) s_ctl->Metrics(out);
+}
+
+void HubControlReportState() {
+  if (s_ctl != nullptr) s_ctl->ReportState();
 }
 
 bool HubControlInit() {
@@ -506,16 +967,27 @@ bool HubControlInit() {
       &mgos_sys_config_get_hub()->control;
 
   s_ctl = new Control(const_cast<struct mgos_config_hub_control *>(ccfg));
+  mgos_event_add_handler(HUB_EV_DATA, hub_control_data_cb, s_ctl);
+  mgos_event_add_handler(MGOS_EVENT_REBOOT, hub_control_reboot_cb, s_ctl);
+
+  mg_rpc_add_handler(c, "Hub.Control.Status", "", Control::StatusRPCHandler,
+                     s_ctl);
 
   mg_rpc_add_handler(c, "Hub.Control.GetLimits", "{sid: %d, subid: %d}",
                      Control::GetLimitsRPCHandler, s_ctl);
-  mg_rpc_add_handler(
-      c, "Hub.Control.SetLimit",
-      "{sid: %d, subid: %d, enable: %B, min: %lf, max: %lf, invert: %B, "
-      "deps: %Q, out: %Q}",
-      Control::SetLimitRPCHandler, s_ctl);
+  mg_rpc_add_handler(c, "Hub.Control.SetLimit", SET_LIMIT_ARGS_FMT,
+                     Control::SetLimitRPCHandler, s_ctl);
+  mg_rpc_add_handler(c, "Hub.Control.SetLimits", "{limits: %T}",
+                     Control::SetLimitsRPCHandler, s_ctl);
+  mg_rpc_add_handler(c, "Hub.Control.RemoveLimit", "{id: %d}",
+                     Control::RemoveLimitRPCHandler, s_ctl);
   mg_rpc_add_handler(c, "Hub.Control.GetOutputs", "{id: %d, name: %Q}",
                      Control::GetOutputsRPCHandler, s_ctl);
+  mg_rpc_add_handler(c, "Hub.Control.SetOutput",
+                     "{id: %d, name: %Q, pin: %d, act: %d}",
+                     Control::SetOutputRPCHandler, s_ctl);
+  mg_rpc_add_handler(c, "Hub.Control.RemoveOutput", "{id: %d}",
+                     Control::RemoveOutputRPCHandler, s_ctl);
   // Backward-compat.
   mg_rpc_add_handler(c, "Hub.Heater.GetStatus", "",
                      hub_heater_get_status_handler, nullptr);
@@ -524,11 +996,8 @@ bool HubControlInit() {
                      hub_heater_set_handler, nullptr);
   mg_rpc_add_handler(c, "Hub.Heater.GetLimits", "{sid: %d, subid: %d}",
                      Control::GetLimitsRPCHandler, s_ctl);
-  mg_rpc_add_handler(
-      c, "Hub.Heater.SetLimits",
-      "{sid: %d, subid: %d, enable: %B, min: %lf, max: %lf, invert: %B, "
-      "deps: %Q, out: %Q}",
-      Control::SetLimitRPCHandler, s_ctl);
+  mg_rpc_add_handler(c, "Hub.Heater.SetLimits", SET_LIMIT_ARGS_FMT,
+                     Control::SetLimitRPCHandler, s_ctl);
 
   mgos_crontab_register_handler(mg_mk_str("heater_on"), heater_crontab_cb,
                                 (void *) 1);
@@ -539,6 +1008,9 @@ bool HubControlInit() {
   mgos_crontab_register_handler(mg_mk_str("ctl_off"), ctl_crontab_cb,
                                 (void *) 0);
 
+  // Evaluate restored data, this also sets staleness deadlines.
+  s_ctl->Eval();
+
   res = true;
 
   return res;
@@ -5,8 +5,10 @@
 
 #include "mgos_timers.hpp"
 
+#include "hub_control_graph.hpp"
 #include "hub_control_limit.hpp"
 #include "hub_control_output.hpp"
+#include "hub_timer_wheel.hpp"
 
 class Control {
  public:
@@ -14,33 +16,86 @@ class Control {
 
   bool IsEnabled() const;
   void SetEnabled(bool enable, const std::string &source);
-  void Eval(bool force = false);
-  void ReportOutputs();
+  // Evaluates all the limits.
+  void Eval();
+  // Evaluates the limits that depend on data of the specified sensor.
+  void EvalSensor(int sid, int subid);
+  // Reports state of all limits and outputs.
+  void ReportState();
   bool GetOutputStatus(const std::string &name_or_id, bool *on,
                        double *last_change);
+  // Saves pending changes now.
+  void Flush();
+  // Limit and output state in Prometheus text format.
+  void Metrics(struct mbuf *out) const;
 
+  static void StatusRPCHandler(struct mg_rpc_request_info *ri, void *cb_arg,
+                               struct mg_rpc_frame_info *fi,
+                               struct mg_str args);
   static void GetLimitsRPCHandler(struct mg_rpc_request_info *ri, void *cb_arg,
                                   struct mg_rpc_frame_info *fi,
                                   struct mg_str args);
   static void SetLimitRPCHandler(struct mg_rpc_request_info *ri, void *cb_arg,
                                  struct mg_rpc_frame_info *fi,
                                  struct mg_str args);
+  static void SetLimitsRPCHandler(struct mg_rpc_request_info *ri, void *cb_arg,
+                                  struct mg_rpc_frame_info *fi,
+                                  struct mg_str args);
+  static void RemoveLimitRPCHandler(struct mg_rpc_request_info *ri,
+                                    void *cb_arg, struct mg_rpc_frame_info *fi,
+                                    struct mg_str args);
   static void GetOutputsRPCHandler(struct mg_rpc_request_info *ri, void *cb_arg,
                                    struct mg_rpc_frame_info *fi,
                                    struct mg_str args);
+  static void SetOutputRPCHandler(struct mg_rpc_request_info *ri, void *cb_arg,
+                                  struct mg_rpc_frame_info *fi,
+                                  struct mg_str args);
+  static void RemoveOutputRPCHandler(struct mg_rpc_request_info *ri,
+                                     void *cb_arg, struct mg_rpc_frame_info *fi,
+                                     struct mg_str args);
 
  private:
-  Limit *GetLimitByID(const std::string &id) const;
-  Output *GetOutputByNameOrID(const std::string &name_or_id) const;
+  // Limits and outputs are stored in hub.control.file.
+  bool Load();
+  bool Save();
+  void MarkDirty();
+  void MigrateConfig();
+  bool UpdateLimit(struct mg_str args, int *id, std::string *error);
+  bool ApplyChanges(std::vector<Limit> *old_limits, std::string *error);
+  int GetNextLimitID() const;
+  // Return index in the table or -1.
+  int FindLimit(const std::string &id) const;
+  int FindOutput(const std::string &name_or_id) const;
+  const Limit *GetOutputUser(const Output &o) const;
+  // Compiles limits into the graph. Returns false if there is a cycle, in
+  // which case the graph and limit state are left as they are, unless
+  // force is set.
+  bool Compile(bool force, std::string *error);
+  void EvalLimit(size_t i, bool eval, double now);
+  void ReportLimit(size_t i, double now);
+  void UpdateOutputs(double now);
 
   struct mgos_config_hub_control *cfg_;
-  std::vector<Limit *> limits_;
-  std::vector<Output *> outputs_;
+  std::vector<Limit> limits_;
+  std::vector<Output> outputs_;
+  LimitGraph graph_;
+  // Result of the last evaluation of each limit, without and with
+  // dependencies taken into account.
+  Bitset limits_raw_on_;
+  Bitset limits_on_;
+  // When data of a limit goes stale, keyed by limit index.
+  TimerWheel stale_wheel_;
   mgos::Timer eval_timer_;
+  mgos::Timer save_timer_;
+  bool dirty_ = false;
+  double dirty_since_ = 0;
+  unsigned int num_changes_ = 0;
+  unsigned int num_saves_ = 0;
+  bool in_eval_ = false;
   double last_action_ts_ = 0.0;
-  double last_eval_ = 0.0;
 };
 
 bool HubControlGetHeaterStatus(bool *heater_on, double *last_action_ts);
-void HubControlReportOutputs();
+void HubControlReportState();
+void HubControlMetrics(struct mbuf *out);
 bool HubControlInit();
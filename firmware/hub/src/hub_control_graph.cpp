@@ -0,0 +1,173 @@
+#include "hub_control_graph.hpp"
+
+#include <algorithm>
+
+#include "mgos.hpp"
+
+#include "hub_control_limit.hpp"
+#include "hub_control_output.hpp"
+#include "hub_data.hpp"
+
+void Bitset::Resize(size_t n) {
+  words_.assign((n + 31) / 32, 0);
+}
+
+void Bitset::Clear() {
+  std::fill(words_.begin(), words_.end(), 0);
+}
+
+void Bitset::Set(size_t i, bool v) {
+  if (v) {
+    words_[i / 32] |= (1U << (i % 32));
+  } else {
+    words_[i / 32] &= ~(1U << (i % 32));
+  }
+}
+
+bool Bitset::Test(size_t i) const {
+  return (words_[i / 32] & (1U << (i % 32))) != 0;
+}
+
+bool Bitset::Intersects(const Bitset &other) const {
+  size_t n = std::min(words_.size(), other.words_.size());
+  for (size_t i = 0; i < n; i++) {
+    if (words_[i] & other.words_[i]) return true;
+  }
+  return false;
+}
+
+void Bitset::Or(const Bitset &other) {
+  size_t n = std::min(words_.size(), other.words_.size());
+  for (size_t i = 0; i < n; i++) {
+    words_[i] |= other.words_[i];
+  }
+}
+
+// static
+std::vector<uint64_t> LimitGraph::GetLimitKeys(const Limit *l) {
+  std::vector<uint64_t> keys = {SensorData::MakeKey(l->sid(), l->subid())};
+  const uint8_t sensor_type = (l->sid() >> 24);
+  // Target temperature of Xavax and BluTRV sensors, used to set thresholds.
+  if (sensor_type == 1) keys.push_back(SensorData::MakeKey(l->sid(), 1));
+  if (sensor_type == 4) keys.push_back(SensorData::MakeKey(l->sid(), 0x4500));
+  return keys;
+}
+
+bool LimitGraph::Compile(const std::vector<Limit> &limits,
+                         const std::vector<Output> &outputs,
+                         std::string *error) {
+  const size_t n = limits.size();
+  nodes_.assign(n, Node());
+  order_.clear();
+  steps_.clear();
+  std::vector<int> num_deps(n);
+  for (size_t i = 0; i < n; i++) {
+    const Limit *l = &limits[i];
+    Node &node = nodes_[i];
+    node.deps.Resize(n);
+    node.outputs.Resize(outputs.size());
+    // Dependencies of unused entries are compiled too, so that a cycle
+    // cannot appear when an entry is filled in later.
+    for (const std::string &id : l->deps()) {
+      size_t j = 0;
+      while (j < n && std::to_string(limits[j].id()) != id) j++;
+      if (j == n) {
+        LOG(LL_ERROR, ("%d: Invalid dependency %s", l->id(), id.c_str()));
+        continue;
+      }
+      if (!node.deps.Test(j)) num_deps[i]++;
+      node.deps.Set(j);
+    }
+    if (!l->IsValid()) continue;
+    for (const std::string &name_or_id : l->outputs()) {
+      size_t j = 0;
+      for (; j < outputs.size(); j++) {
+        const Output *o = &outputs[j];
+        if (!o->IsValid()) continue;
+        if (o->name() == name_or_id || std::to_string(o->id()) == name_or_id) {
+          break;
+        }
+      }
+      if (j == outputs.size()) {
+        LOG(LL_ERROR, ("%d: Invalid output %s", l->id(), name_or_id.c_str()));
+        continue;
+      }
+      node.outputs.Set(j);
+    }
+  }
+
+  // Kahn's algorithm, lowest index first among the ready ones.
+  std::vector<bool> done(n);
+  for (bool progress = true; progress;) {
+    progress = false;
+    for (size_t i = 0; i < n; i++) {
+      if (done[i] || num_deps[i] > 0) continue;
+      order_.push_back(i);
+      done[i] = true;
+      progress = true;
+      for (size_t j = 0; j < n; j++) {
+        if (nodes_[j].deps.Test(i)) num_deps[j]--;
+      }
+    }
+  }
+  bool res = true;
+  if (order_.size() < n) {
+    std::string ids;
+    for (size_t i = 0; i < n; i++) {
+      if (done[i]) continue;
+      if (!ids.empty()) ids.append(",");
+      ids.append(std::to_string(limits[i].id()));
+      order_.push_back(i);
+    }
+    *error = mgos::SPrintf("dependency cycle in limits %s", ids.c_str());
+    res = false;
+  }
+
+  // Inactive limits are always off, no need to evaluate them.
+  order_.erase(std::remove_if(order_.begin(), order_.end(),
+                              [&limits](size_t i) {
+                                const Limit &l = limits[i];
+                                return !l.IsValid() || !l.enable();
+                              }),
+               order_.end());
+  std::vector<size_t> pos(n);
+  for (size_t k = 0; k < order_.size(); k++) pos[order_[k]] = k;
+  for (size_t i : order_) {
+    const Limit *l = &limits[i];
+    for (uint64_t key : GetLimitKeys(l)) {
+      std::vector<Step> &steps = steps_[key];
+      steps.push_back({i, true});
+      for (size_t j : order_) {
+        if (nodes_[j].deps.Test(i)) steps.push_back({j, false});
+      }
+    }
+  }
+  for (auto &it : steps_) {
+    std::vector<Step> &steps = it.second;
+    std::sort(steps.begin(), steps.end(), [&pos](const Step &a, const Step &b) {
+      if (a.limit != b.limit) return pos[a.limit] < pos[b.limit];
+      return a.eval > b.eval;
+    });
+    // Keep one step per limit, evaluation takes precedence.
+    steps.erase(std::unique(steps.begin(), steps.end(),
+                            [](const Step &a, const Step &b) {
+                              return a.limit == b.limit;
+                            }),
+                steps.end());
+  }
+  return res;
+}
+
+const LimitGraph::Node &LimitGraph::node(size_t i) const {
+  return nodes_[i];
+}
+
+const std::vector<size_t> &LimitGraph::order() const {
+  return order_;
+}
+
+const std::vector<LimitGraph::Step> *LimitGraph::GetSteps(uint64_t key) const {
+  const auto it = steps_.find(key);
+  if (it == steps_.end()) return nullptr;
+  return &it->second;
+}
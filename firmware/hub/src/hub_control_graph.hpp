@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+class Limit;
+class Output;
+
+class Bitset {
+ public:
+  void Resize(size_t n);
+  void Clear();
+  void Set(size_t i, bool v = true);
+  bool Test(size_t i) const;
+  bool Intersects(const Bitset &other) const;
+  void Or(const Bitset &other);
+
+ private:
+  std::vector<uint32_t> words_;
+};
+
+// Limit dependencies and outputs compiled to indices into the limit and
+// output tables, so that evaluation does not need to resolve anything.
+class LimitGraph {
+ public:
+  struct Node {
+    Bitset deps;     // Limits that inhibit this one when on.
+    Bitset outputs;  // Outputs this limit turns on.
+  };
+
+  // A limit to process when sensor data changes.
+  // Limits that use the sensor are re-evaluated, limits that depend on them
+  // only need to re-check their dependencies.
+  struct Step {
+    size_t limit;
+    bool eval;
+  };
+
+  // Returns false if dependencies form a cycle. The graph is still usable,
+  // limits on the cycle are evaluated in table order.
+  // Disabled and invalid limits are not evaluated at all.
+  bool Compile(const std::vector<Limit> &limits,
+               const std::vector<Output> &outputs, std::string *error);
+
+  const Node &node(size_t i) const;
+  // Enabled limits, dependencies before dependents.
+  const std::vector<size_t> &order() const;
+  // Steps for a sensor key, in evaluation order. nullptr if none.
+  const std::vector<Step> *GetSteps(uint64_t key) const;
+
+  // Sensors whose data a limit depends on.
+  static std::vector<uint64_t> GetLimitKeys(const Limit *l);
+
+ private:
+  std::vector<Node> nodes_;
+  std::vector<size_t> order_;
+  std::map<uint64_t, std::vector<Step>> steps_;
+};
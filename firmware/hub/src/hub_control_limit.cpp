@@ -4,85 +4,83 @@
 
 #include "hub_data.hpp"
 
-Limit::Limit(int id, struct mgos_config_hub_control_limit *l)
-    : id_(id), l_(l), on_(false), last_change_(0) {
+Limit::Limit(int id, const LimitConfig &cfg)
+    : id_(id), cfg_(cfg), on_(false), last_change_(0) {
   if (!IsValid()) return;
   LOG(LL_INFO, ("Limit %s", ToString().c_str()));
 }
 
 std::string Limit::ToString() const {
   return mgos::SPrintf(
-      "[%d %d/%d en %d %.2lf-%.2lf inv %d deps %s out %s; on %d]", id(), sid(),
-      subid(), enable(), min(), max(), invert(), DepsStr().c_str(),
-      OutStr().c_str(), on_);
+      "[%d %d/%d en %d %.2lf-%.2lf inv %d st %d deps %s out %s; on %d]", id(),
+      sid(), subid(), enable(), min(), max(), invert(), stale(),
+      DepsStr().c_str(), OutStr().c_str(), on_);
+}
+
+void Limit::ToJSON(std::string *out) const {
+  mgos::JSONAppendStringf(out,
+                          "{id: %d, sid: %d, subid: %d, enable: %B, "
+                          "min: %.2lf, max: %.2lf, invert: %B, stale: %d, "
+                          "deps: %Q, out: %Q}",
+                          id(), sid(), subid(), enable(), min(), max(),
+                          invert(), stale(), DepsStr().c_str(),
+                          OutStr().c_str());
 }
 
 int Limit::id() const {
   return id_;
 }
 
-int Limit::sid() const {
-  return l_->sid;
+const LimitConfig &Limit::cfg() const {
+  return cfg_;
 }
 
-void Limit::set_sid(int sid) const {
-  l_->sid = sid;
+void Limit::set_cfg(const LimitConfig &cfg) {
+  cfg_ = cfg;
 }
 
-int Limit::subid() const {
-  return l_->subid;
+int Limit::sid() const {
+  return cfg_.sid;
 }
 
-void Limit::set_subid(int subid) const {
-  l_->subid = subid;
+int Limit::subid() const {
+  return cfg_.subid;
 }
 
 bool Limit::enable() const {
-  return l_->enable;
-}
-
-void Limit::set_enable(bool enable) {
-  l_->enable = enable;
+  return cfg_.enable;
 }
 
 double Limit::min() const {
-  return l_->min;
+  return cfg_.min;
 }
 
 void Limit::set_min(double min) {
-  l_->min = min;
+  cfg_.min = min;
 }
 
 double Limit::max() const {
-  return l_->max;
+  return cfg_.max;
 }
 
 void Limit::set_max(double max) {
-  l_->max = max;
+  cfg_.max = max;
 }
 
 bool Limit::invert() const {
-  return l_->invert;
-}
-
-void Limit::set_invert(bool invert) {
-  l_->invert = invert;
-}
-
-std::string Limit::DepsStr() const {
-  return (l_->deps != nullptr ? l_->deps : "");
+  return cfg_.invert;
 }
 
-void Limit::set_deps(const std::string &deps) {
-  mgos_conf_set_str(&l_->deps, deps.c_str());
+int Limit::stale() const {
+  return cfg_.stale;
 }
 
-std::string Limit::OutStr() const {
-  return (l_->out != nullptr ? l_->out : "");
+const std::string &Limit::DepsStr() const {
+  return cfg_.deps;
 }
 
-void Limit::set_out(const std::string &out) {
-  mgos_conf_set_str(&l_->out, out.c_str());
+const std::string &Limit::OutStr() const {
+  return cfg_.out;
 }
 
 std::set<std::string> Limit::deps() const {
@@ -104,67 +102,67 @@ std::set<std::string> Limit::ParseCommaStr(const std::string &out) {
   return outputs;
 }
 
-bool Limit::IsValid() {
+bool Limit::IsValid() const {
   return sid() >= 0 && subid() >= 0 && min() <= max();
 }
 
 bool Limit::Eval(bool quiet) {
   double age;
   bool want_on = false;
-  bool enabled = l_->enable;
-  struct SensorData sd;
+  bool enabled = cfg_.enable;
+  const struct SensorData *sd;
   if (!IsValid()) return false;
 
   if (!enabled) {
     want_on = false;
-  } else if (!hub_get_data(l_->sid, l_->subid, &sd)) {
+  } else if ((sd = hub_get_data(cfg_.sid, cfg_.subid)) == nullptr) {
     if (!quiet) {
-      LOG(LL_INFO, ("S%d/%d: no data yet", l_->sid, l_->subid));
+      LOG(LL_INFO, ("S%d/%d: no data yet", cfg_.sid, cfg_.subid));
     }
     want_on = false;
-  } else if ((age = cs_time() - sd.ts) > 300) {
+  } else if ((age = cs_time() - sd->ts) > stale()) {
     if (!quiet) {
       LOG(LL_INFO,
-          ("S%d/%d: data is stale (%.3lf old)", sd.sid, sd.subid, age));
+          ("S%d/%d: data is stale (%.3lf old)", sd->sid, sd->subid, age));
     }
     want_on = false;
   } else if (invert()) {
-    if (!on_ && sd.value > max()) {
+    if (!on_ && sd->value > max()) {
       if (!quiet) {
         LOG(LL_INFO,
-            ("S%d/%d: %.3lf > %.3lf", sd.sid, sd.subid, sd.value, max()));
+            ("S%d/%d: %.3lf > %.3lf", sd->sid, sd->subid, sd->value, max()));
       }
       want_on = true;
-    } else if (on_ && sd.value > min()) {
+    } else if (on_ && sd->value > min()) {
       if (!quiet) {
-        LOG(LL_INFO, ("S%d/%d: %s !(%.3lf; min %.3lf max %.3lf)", sd.sid,
-                      sd.subid, "Not ok", sd.value, min(), max()));
+        LOG(LL_INFO, ("S%d/%d: %s !(%.3lf; min %.3lf max %.3lf)", sd->sid,
+                      sd->subid, "Not ok", sd->value, min(), max()));
       }
       want_on = true;
     } else {
       if (!quiet) {
-        LOG(LL_INFO, ("S%d/%d: %s !(%.3lf; min %.3lf max %.3lf)", sd.sid,
-                      sd.subid, "Ok", sd.value, min(), max()));
+        LOG(LL_INFO, ("S%d/%d: %s !(%.3lf; min %.3lf max %.3lf)", sd->sid,
+                      sd->subid, "Ok", sd->value, min(), max()));
       }
       want_on = false;
     }
   } else {
-    if (!on_ && sd.value < l_->min) {
+    if (!on_ && sd->value < min()) {
       if (!quiet) {
         LOG(LL_INFO,
-            ("S%d/%d: %.3lf < %.3lf", sd.sid, sd.subid, sd.value, l_->min));
+            ("S%d/%d: %.3lf < %.3lf", sd->sid, sd->subid, sd->value, min()));
       }
       want_on = true;
-    } else if (on_ && sd.value < l_->max) {
+    } else if (on_ && sd->value < max()) {
       if (!quiet) {
-        LOG(LL_INFO, ("S%d/%d: %s (%.3lf; min %.3lf max %.3lf)", sd.sid,
-                      sd.subid, "Not ok", sd.value, l_->min, l_->max));
+        LOG(LL_INFO, ("S%d/%d: %s (%.3lf; min %.3lf max %.3lf)", sd->sid,
+                      sd->subid, "Not ok", sd->value, min(), max()));
       }
       want_on = true;
     } else {
       if (!quiet) {
-        LOG(LL_INFO, ("S%d/%d: %s (%.3lf; min %.3lf max %.3lf)", sd.sid,
-                      sd.subid, "Ok", sd.value, l_->min, l_->max));
+        LOG(LL_INFO, ("S%d/%d: %s (%.3lf; min %.3lf max %.3lf)", sd->sid,
+                      sd->subid, "Ok", sd->value, min(), max()));
       }
       want_on = false;
     }
@@ -3,42 +3,55 @@
 #include <set>
 #include <string>
 
-struct mgos_config_hub_control_limit;
+struct LimitConfig {
+  int sid = -1;
+  int subid = 0;
+  bool enable = false;
+  double min = 0.0;
+  double max = 0.0;
+  // Going above max is not ok.
+  bool invert = false;
+  // Limits(s) that must eval to ok; comma-separated list of limit ids.
+  std::string deps;
+  // Output(s) that this limit controls; comma-separated list of names or ids.
+  std::string out;
+  // Data older than this many seconds is not acted upon.
+  int stale = 300;
+};
 
 class Limit {
  public:
-  Limit(int id, struct mgos_config_hub_control_limit *l);
+  Limit(int id, const LimitConfig &cfg);
 
   static std::set<std::string> ParseCommaStr(const std::string &out);
 
   int id() const;
+  const LimitConfig &cfg() const;
+  void set_cfg(const LimitConfig &cfg);
   int sid() const;
-  void set_sid(int sid) const;
   int subid() const;
-  void set_subid(int subid) const;
   bool enable() const;
-  void set_enable(bool enable);
   double min() const;
   void set_min(double min);
   double max() const;
   void set_max(double max);
   bool invert() const;
-  void set_invert(bool invert);
-  std::string DepsStr() const;
-  void set_deps(const std::string &out);
-  std::string OutStr() const;
-  void set_out(const std::string &out);
+  int stale() const;
+  const std::string &DepsStr() const;
+  const std::string &OutStr() const;
 
   std::string ToString() const;
+  // Appends the limit as a JSON object.
+  void ToJSON(std::string *out) const;
 
   std::set<std::string> deps() const;
   std::set<std::string> outputs() const;
-  bool IsValid();
+  bool IsValid() const;
   bool Eval(bool quiet = false);
 
  private:
-  const int id_;
-  struct mgos_config_hub_control_limit *l_;
+  int id_;
+  LimitConfig cfg_;
 
   bool on_;
   double last_change_;
@@ -1,48 +1,68 @@
 #include "hub_control_output.hpp"
 
-#include "mgos.h"
+#include "mgos.hpp"
 
 #include "hub_data.hpp"
 
-Output::Output(struct mgos_config_hub_control_output *o)
-    : o_(o), on_(false), last_change_(0) {
+Output::Output(const OutputConfig &cfg)
+    : cfg_(cfg), on_(false), last_change_(0) {
+  Setup();
+}
+
+void Output::Setup() {
   char buf[8];
   if (!IsValid()) return;
-  LOG(LL_INFO, ("Output %d: name '%s', pin %s, act %d", o_->id, o_->name,
-                mgos_gpio_str(o_->pin, buf), o_->act));
-  mgos_gpio_setup_output(o_->pin, !o_->act);
+  LOG(LL_INFO, ("Output %d: name '%s', pin %s, act %d", cfg_.id,
+                cfg_.name.c_str(), mgos_gpio_str(cfg_.pin, buf), cfg_.act));
+  mgos_gpio_setup_output(cfg_.pin, (on_ ? cfg_.act : !cfg_.act));
 }
 
 int Output::id() const {
-  return o_->id;
+  return cfg_.id;
 }
 
-std::string Output::name() const {
-  if (o_->name == nullptr) return "";
-  return std::string(o_->name);
+const OutputConfig &Output::cfg() const {
+  return cfg_;
+}
+
+void Output::set_cfg(const OutputConfig &cfg) {
+  if (cfg.pin == cfg_.pin && cfg.act == cfg_.act) {
+    cfg_ = cfg;
+    return;
+  }
+  if (IsValid() && cfg.pin != cfg_.pin) {
+    // Nothing controls the old pin anymore, leave it inactive.
+    mgos_gpio_write(cfg_.pin, !cfg_.act);
+  }
+  cfg_ = cfg;
+  Setup();
+}
+
+const std::string &Output::name() const {
+  return cfg_.name;
 }
 
 int Output::pin() const {
-  return o_->pin;
+  return cfg_.pin;
 }
 
 std::string Output::pin_name() const {
   char buf[8];
-  return std::string(mgos_gpio_str(o_->pin, buf));
+  return std::string(mgos_gpio_str(cfg_.pin, buf));
 }
 
 int Output::act() const {
-  return o_->act;
+  return cfg_.act;
 }
 
 bool Output::IsValid() const {
-  return (o_->pin >= 0 && o_->id >= 0 && o_->name != nullptr);
+  return (cfg_.pin >= 0 && cfg_.id >= 0 && !cfg_.name.empty());
 }
 
 bool Output::GetState() const {
   if (!IsValid()) {
     LOG(LL_INFO, ("%d (%s): attempted to get state of an invalid output",
-                  o_->id, (o_->name != nullptr ? o_->name : "")));
+                  cfg_.id, cfg_.name.c_str()));
     return false;
   }
   return on_;
@@ -51,7 +71,7 @@ bool Output::GetState() const {
 bool Output::GetStateWithTimestamp(double *last_change) const {
   if (!IsValid()) {
     LOG(LL_INFO, ("%d (%s): attempted to get state of an invalid output",
-                  o_->id, (o_->name != nullptr ? o_->name : "")));
+                  cfg_.id, cfg_.name.c_str()));
     *last_change = 0;
     return false;
   }
@@ -66,14 +86,14 @@ static const char *onoff(bool on) {
 void Output::SetState(bool new_state) {
   if (!IsValid()) {
     LOG(LL_INFO, ("%d (%s): attempted to set state of an invalid output",
-                  o_->id, (o_->name != nullptr ? o_->name : "")));
+                  cfg_.id, cfg_.name.c_str()));
     return;
   }
   bool old_state = GetState();
   if (new_state == old_state) return;
-  LOG(LL_INFO, ("%s (%d): %s -> %s", o_->name, o_->id, onoff(old_state),
-                onoff(new_state)));
-  mgos_gpio_write(o_->pin, (new_state ? o_->act : !o_->act));
+  LOG(LL_INFO, ("%s (%d): %s -> %s", cfg_.name.c_str(), cfg_.id,
+                onoff(old_state), onoff(new_state)));
+  mgos_gpio_write(cfg_.pin, (new_state ? cfg_.act : !cfg_.act));
   last_change_ = mg_time();
   on_ = new_state;
   Report();
@@ -84,3 +104,8 @@ void Output::Report() {
   int v = (GetState() ? 1 : 0);
   report_to_server(mgos_sys_config_get_hub_out_sid(), id(), mg_time(), v);
 }
+
+void Output::ToJSON(std::string *out) const {
+  mgos::JSONAppendStringf(out, "{id: %d, name: %Q, pin: %d, act: %d}",
+                          cfg_.id, cfg_.name.c_str(), cfg_.pin, cfg_.act);
+}
@@ -2,13 +2,22 @@
 
 #include <string>
 
-struct mgos_config_hub_control_output;
+struct OutputConfig {
+  int id = -1;
+  std::string name;
+  int pin = -1;
+  // Pin active state.
+  int act = 1;
+};
 
 class Output {
  public:
-  explicit Output(struct mgos_config_hub_control_output *o);
+  explicit Output(const OutputConfig &cfg);
   int id() const;
-  std::string name() const;
+  const OutputConfig &cfg() const;
+  // Changes pin configuration, output state is preserved.
+  void set_cfg(const OutputConfig &cfg);
+  const std::string &name() const;
   int pin() const;
   std::string pin_name() const;
   int act() const;
@@ -17,9 +26,13 @@ class Output {
   bool GetStateWithTimestamp(double *last_change) const;
   void SetState(bool new_state);
   void Report();
+  // Appends the output as a JSON object.
+  void ToJSON(std::string *out) const;
 
  private:
-  struct mgos_config_hub_control_output *o_;
+  void Setup();
+
+  OutputConfig cfg_;
 
   bool on_;
   double last_change_;
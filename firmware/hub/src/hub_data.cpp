@@ -1,55 +1,92 @@
 #include "hub_data.hpp"
 
+#include <sys/stat.h>
+
+#include <algorithm>
 #include <cmath>
-#include <map>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <vector>
 
+#include "common/cs_base64.h"
 #include "mgos.hpp"
 #include "mgos_rpc.h"
 
-static std::map<uint64_t, SensorData> s_data;
-
-uint64_t SensorData::GetKey() const {
-  return MakeKey(sid, subid);
-}
-
-uint64_t SensorData::MakeKey(int sid, int subid) {
-  return ((static_cast<uint64_t>(sid) << 32) | subid);
-}
-
-std::string SensorData::ToString() const {
-  return mgos::SPrintf("%d/%d (%s) %.3lf @ %.3lf", sid, subid, name.c_str(),
-                       value, ts);
-}
+#include "hub_data_bin.hpp"
+#include "hub_data_log.hpp"
+#include "hub_data_multi.hpp"
+#include "hub_dedup.hpp"
+#include "hub_data_table.hpp"
+#include "hub_history.hpp"
+#include "hub_names.hpp"
+#include "hub_ratelimit.hpp"
+#include "hub_report.hpp"
+#include "hub_rollup.hpp"
+#include "hub_stats.hpp"
 
-SensorData::SensorData(int _sid, int _subid, double _ts, double _value)
-    : sid(_sid), subid(_subid), ts(_ts), value(_value) {
-}
+// Data from before the switch to binary snapshot + log.
+#define LEGACY_DATA_FILE "hub_data.json"
 
-void report_to_server_sd(const struct SensorData *sd) {
-  if (sd->sid < 0) return;
-  if (mgos_sys_config_get_hub_data_server_addr() == NULL) return;
-  struct mg_rpc_call_opts opts = {};
-  opts.dst = mg_mk_str(mgos_sys_config_get_hub_data_server_addr()),
-  mg_rpc_callf(mgos_rpc_get_global(), mg_mk_str("Sensor.Data"), NULL, NULL,
-               &opts, "{sid: %d, subid: %d, ts: %lf, v: %lf}", sd->sid,
-               sd->subid, sd->ts, sd->value);
-}
+static SensorTable s_data;
+// Keys changed since the last save.
+static std::set<uint64_t> s_dirty;
+static size_t s_log_size = 0;
+static bool s_compact_pending = false;
+// Change sequence of the data table. Removal of entries is recorded in
+// s_reset_seq, epoch distinguishes boots.
+static uint32_t s_seq = 0;
+static uint32_t s_reset_seq = 0;
+static uint32_t s_epoch = 0;
 
 static void hub_add_data_internal(const struct SensorData *sd, bool report) {
   if (sd->ts <= 0 || sd->sid < 0) return;
-  SensorData &sde = s_data[sd->GetKey()];
-  if (sde.sid < 0) {
+  bool inserted;
+  SensorData *sde = s_data.FindOrInsert(sd->GetKey(), &inserted);
+  if (inserted) {
     LOG(LL_INFO, ("New sensor %d/%d", sd->sid, sd->subid));
   }
-  if (sd->ts <= sde.ts) {
+  if (sd->ts < sde->ts && mgos_sys_config_get_hub_data_accept_late()) {
+    // E.g. a backlog flushed by a relay. Current value stays as is,
+    // but history and the server get the point.
+    LOG(LL_DEBUG, ("Late data: %s", sd->ToString().c_str()));
+    HUB_COUNTER_INC(rx_late);
+    hub_history_add(sd);
+    hub_rollup_add(sd);
+    if (report) {
+      hub_report_add(sd);
+    }
+    return;
+  }
+  if (sd->ts <= sde->ts) {
     LOG(LL_INFO, ("Old data: %s", sd->ToString().c_str()));
+    HUB_COUNTER_INC(rx_old);
     return;
   }
-  sde = *sd;
+  *sde = *sd;
+  sde->seq = ++s_seq;
+  s_dirty.insert(sd->GetKey());
   LOG(LL_INFO, ("New data: %s", sd->ToString().c_str()));
+  hub_history_add(sd);
+  hub_rollup_add(sd);
   if (report) {
-    report_to_server_sd(sd);
+    hub_report_add(sd);
   }
+  // Handlers may add data, which can move entries, so pass a copy.
+  struct SensorData ev_sd = *sde;
+  mgos_event_trigger(HUB_EV_DATA, &ev_sd);
+}
+
+// Restores an entry loaded from storage. Unlike hub_add_data, does not log,
+// report or add to history: this is not new data.
+static void hub_data_restore(struct SensorData *sd) {
+  if (sd->ts <= 0 || sd->sid < 0) return;
+  bool inserted;
+  SensorData *sde = s_data.FindOrInsert(sd->GetKey(), &inserted);
+  if (sd->ts <= sde->ts) return;
+  *sde = std::move(*sd);
+  // For Hub.Data.List: a full listing includes everything with seq > 0.
+  sde->seq = ++s_seq;
 }
 
 void report_to_server(int sid, int subid, double ts, double value) {
@@ -61,34 +98,90 @@ void hub_add_data(const struct SensorData *sd) {
   hub_add_data_internal(sd, true);
 }
 
-bool hub_get_data(int sid, int subid, struct SensorData *sd) {
-  const auto it = s_data.find(SensorData::MakeKey(sid, subid));
-  if (it == s_data.end()) return false;
-  *sd = it->second;
-  return true;
+const struct SensorData *hub_get_data(int sid, int subid) {
+  return s_data.Find(SensorData::MakeKey(sid, subid));
 }
 
-static void hub_data_save_timer_cb(void *arg UNUSED_ARG) {
+// Writes all the data to a new snapshot and removes the log.
+static bool hub_data_compact(void) {
   const char *fn = mgos_sys_config_get_hub_data_file();
-  FILE *fp = fopen(fn, "w");
-  if (fp == NULL) return;
-  int n = 0, n_bytes = 0;
-  struct json_out out = JSON_OUT_FILE(fp);
-  for (const auto &e : s_data) {
-    const struct SensorData &sd = e.second;
-    n_bytes += json_printf(
-        &out, "{sid: %d, subid: %d, name: %Q, ts: %.3lf, value: %lf}\n", sd.sid,
-        sd.subid, sd.name.c_str(), sd.ts, sd.value);
+  const char *log_fn = mgos_sys_config_get_hub_data_log_file();
+  if (fn == NULL) return false;
+  std::string tmp_fn = mgos::SPrintf("%s.tmp", fn);
+  FILE *fp = fopen(tmp_fn.c_str(), "wb");
+  if (fp == NULL) return false;
+  int n = 0;
+  bool ok = hub_data_log_write_header(fp);
+  for (const SensorData &sd : s_data) {
+    if (!ok) break;
+    ok = hub_data_log_write_record(fp, sd);
     n++;
   }
-  fclose(fp);
-  LOG(LL_INFO, ("Saved %d entries (%d bytes) to %s", n, n_bytes, fn));
+  ok = (fclose(fp) == 0 && ok);
+  if (!ok || rename(tmp_fn.c_str(), fn) != 0) {
+    LOG(LL_ERROR, ("Failed to write %s", fn));
+    remove(tmp_fn.c_str());
+    return false;
+  }
+  if (log_fn != NULL) remove(log_fn);
+  s_log_size = 0;
+  s_dirty.clear();
+  s_compact_pending = false;
+  LOG(LL_INFO, ("Saved %d entries to %s", n, fn));
+  return true;
 }
 
-static void hub_data_load(const char *fn) {
-  if (fn == NULL) return;
+// Appends entries that changed since the last save to the log.
+static bool hub_data_append_log(void) {
+  const char *log_fn = mgos_sys_config_get_hub_data_log_file();
+  if (log_fn == NULL) return hub_data_compact();
+  FILE *fp = fopen(log_fn, "ab");
+  if (fp == NULL) return false;
+  int n = 0;
+  bool ok = (s_log_size > 0 || hub_data_log_write_header(fp));
+  for (uint64_t key : s_dirty) {
+    if (!ok) break;
+    const SensorData *sd = s_data.Find(key);
+    if (sd == nullptr) continue;
+    ok = hub_data_log_write_record(fp, *sd);
+    n++;
+  }
+  s_log_size = ftell(fp);
+  ok = (fclose(fp) == 0 && ok);
+  if (!ok) {
+    // Log may now end with a partial record, start over.
+    LOG(LL_ERROR, ("Failed to write %s", log_fn));
+    s_compact_pending = true;
+    return false;
+  }
+  s_dirty.clear();
+  LOG(LL_DEBUG, ("Logged %d entries to %s (%d bytes)", n, log_fn,
+                 (int) s_log_size));
+  return true;
+}
+
+static void hub_data_save(void) {
+  hub_names_flush();
+  const size_t log_max_size = mgos_sys_config_get_hub_data_log_max_size();
+  if (s_compact_pending || s_log_size >= log_max_size) {
+    hub_data_compact();
+  } else if (!s_dirty.empty()) {
+    hub_data_append_log();
+  }
+}
+
+static void hub_data_save_timer_cb(void *arg UNUSED_ARG) {
+  hub_data_save();
+}
+
+static void hub_data_reboot_cb(int ev UNUSED_ARG, void *ev_data UNUSED_ARG,
+                               void *userdata UNUSED_ARG) {
+  hub_data_save();
+}
+
+static int hub_data_load_json(const char *fn) {
   FILE *fp = fopen(fn, "r");
-  if (fp == NULL) return;
+  if (fp == NULL) return -1;
   char buf[256];
   int n = 0;
   while (fgets(buf, sizeof(buf), fp) != NULL) {
@@ -98,14 +191,45 @@ static void hub_data_load(const char *fn) {
                "{sid: %d, subid: %d, name: %Q, ts: %lf, value: %lf}", &sd.sid,
                &sd.subid, &name, &sd.ts, &sd.value);
     if (name != NULL) {
-      sd.name = name;
+      sd.name_id = hub_name_intern(name, strlen(name));
       free(name);
     }
-    hub_add_data(&sd);
+    hub_data_restore(&sd);
     n++;
   }
   fclose(fp);
-  LOG(LL_INFO, ("Loaded %d entries from %s", n, fn));
+  return n;
+}
+
+static void hub_data_load(void) {
+  const char *fn = mgos_sys_config_get_hub_data_file();
+  const char *log_fn = mgos_sys_config_get_hub_data_log_file();
+  int64_t start = mgos_uptime_micros();
+  int n = -1, n_log = -1;
+  if (fn != NULL) {
+    n = hub_data_log_read(fn, hub_data_restore);
+  }
+  if (n < 0) {
+    // Convert from the old format.
+    n = hub_data_load_json(LEGACY_DATA_FILE);
+    if (n >= 0 && hub_data_compact()) {
+      LOG(LL_INFO, ("Converted %s", LEGACY_DATA_FILE));
+      // Snapshot may have been written in its place.
+      if (strcmp(fn, LEGACY_DATA_FILE) != 0) remove(LEGACY_DATA_FILE);
+    }
+  }
+  if (log_fn != NULL) {
+    n_log = hub_data_log_read(log_fn, hub_data_restore);
+    struct stat st;
+    if (n_log >= 0 && stat(log_fn, &st) == 0) {
+      s_log_size = st.st_size;
+    } else {
+      remove(log_fn);
+    }
+  }
+  LOG(LL_INFO, ("Loaded %d + %d entries in %d ms", std::max(n, 0),
+                std::max(n_log, 0),
+                (int) ((mgos_uptime_micros() - start) / 1000)));
 }
 
 static void hub_data_get_handler(struct mg_rpc_request_info *ri,
@@ -115,14 +239,14 @@ static void hub_data_get_handler(struct mg_rpc_request_info *ri,
   int sid = -1, subid = -1;
   json_scanf(args.p, args.len, ri->args_fmt, &sid, &subid);
 
-  struct SensorData sd;
-  if (!hub_get_data(sid, subid, &sd)) {
+  const struct SensorData *sd = hub_get_data(sid, subid);
+  if (sd == nullptr) {
     mg_rpc_send_errorf(ri, -1, "invalid sid %d/%d", sid, subid);
     return;
   }
 
   mg_rpc_send_responsef(ri, "{sid: %d, subid: %d, ts: %.3lf, value: %.3lf}",
-                        sid, subid, sd.ts, sd.value);
+                        sid, subid, sd->ts, sd->value);
 }
 
 static void hub_data_reset_handler(struct mg_rpc_request_info *ri,
@@ -133,97 +257,208 @@ static void hub_data_reset_handler(struct mg_rpc_request_info *ri,
   json_scanf(args.p, args.len, ri->args_fmt, &sid, &subid);
   if (sid < 0 && subid < 0) {
     LOG(LL_INFO, ("Reset all data"));
-    s_data.clear();
+    s_data.Clear();
+    s_reset_seq = ++s_seq;
+    s_compact_pending = true;
     mg_rpc_send_responsef(ri, nullptr);
     return;
   }
-  const auto it = s_data.find(SensorData::MakeKey(sid, subid));
-  if (it == s_data.end()) {
+  if (!s_data.Erase(SensorData::MakeKey(sid, subid))) {
     mg_rpc_send_errorf(ri, 404, "Not Found");
     return;
   }
-  s_data.erase(it);
+  s_reset_seq = ++s_seq;
+  s_compact_pending = true;
   mg_rpc_send_responsef(ri, nullptr);
 }
 
+bool hub_data_metrics(struct mbuf *out, struct DataMetricsPos *pos,
+                      size_t num) {
+  const SensorTable &data = s_data;
+  for (; pos->family < 2; pos->family++, pos->started = false) {
+    if (num == 0) return true;
+    SensorTable::const_iterator it = data.begin();
+    if (pos->started) {
+      it = data.UpperBound(pos->key);
+    } else if (pos->family == 0) {
+      hub_stats_prom_header(out, "hub_sensor_value", "gauge",
+                            "Last value received from the sensor.");
+    } else {
+      hub_stats_prom_header(
+          out, "hub_sensor_timestamp_seconds", "gauge",
+          "Time of the last value received from the sensor.");
+    }
+    pos->started = true;
+    for (; it != data.end() && num > 0; ++it, num--) {
+      const SensorData &sd = *it;
+      if (pos->family == 0) {
+        hub_stats_prom_printf(
+            out,
+            "hub_sensor_value{sid=\"%d\",subid=\"%d\",name=\"%s\"} %g\n",
+            sd.sid, sd.subid, hub_stats_prom_escape(sd.GetName()).c_str(),
+            sd.value);
+      } else {
+        hub_stats_prom_printf(
+            out,
+            "hub_sensor_timestamp_seconds{sid=\"%d\",subid=\"%d\"} %.3lf\n",
+            sd.sid, sd.subid, sd.ts);
+      }
+      pos->key = sd.GetKey();
+    }
+    if (it != data.end()) return true;
+  }
+  return false;
+}
+
+static void hub_data_entry_json(struct json_out *out, const SensorData &sd) {
+  if (sd.name_id != HUB_NAME_NONE) {
+    json_printf(out, "{sid: %d, subid: %d, name: %Q, ts: %.3lf, value: %.3lf}",
+                sd.sid, sd.subid, sd.GetName(), sd.ts, sd.value);
+  } else {
+    json_printf(out, "{sid: %d, subid: %d, ts: %.3lf, value: %.3lf}", sd.sid,
+                sd.subid, sd.ts, sd.value);
+  }
+}
+
+// Without arguments, returns all the entries as an array.
+// With since and/or limit, returns up to limit entries changed after
+// the since cursor, oldest change first, and the cursor to use next.
+// If entries have been removed or the hub restarted (epoch differs)
+// since the cursor, the client should discard what it has: full is set
+// and entries are returned from the start.
 static void hub_data_list_handler(struct mg_rpc_request_info *ri,
                                   void *cb_arg UNUSED_ARG,
                                   struct mg_rpc_frame_info *fi UNUSED_ARG,
-                                  struct mg_str args UNUSED_ARG) {
+                                  struct mg_str args) {
+  unsigned int since = 0, epoch = 0;
+  int limit = 0;
+  int n = json_scanf(args.p, args.len, ri->args_fmt, &since, &limit, &epoch);
   struct mbuf mb;
-  bool first = true;
   mbuf_init(&mb, 50);
   struct json_out out = JSON_OUT_MBUF(&mb);
-  json_printf(&out, "[");
-  for (const auto &e : s_data) {
-    const struct SensorData &sd = e.second;
-    if (!first) json_printf(&out, ", ");
-    if (!sd.name.empty()) {
-      json_printf(&out,
-                  "{sid: %d, subid: %d, name: %Q, ts: %.3lf, value: %.3lf}",
-                  sd.sid, sd.subid, sd.name.c_str(), sd.ts, sd.value);
-    } else {
-      json_printf(&out, "{sid: %d, subid: %d, ts: %.3lf, value: %.3lf}", sd.sid,
-                  sd.subid, sd.ts, sd.value);
+  if (n <= 0) {
+    json_printf(&out, "[");
+    for (const SensorData &sd : s_data) {
+      if (mb.len > 1) json_printf(&out, ", ");
+      hub_data_entry_json(&out, sd);
     }
-    first = false;
+    json_printf(&out, "]");
+    mg_rpc_send_responsef(ri, "%.*s", (int) mb.len, mb.buf);
+    mbuf_free(&mb);
+    return;
+  }
+  bool full = false;
+  if (epoch != s_epoch || since < s_reset_seq || since > s_seq) {
+    since = 0;
+    full = true;
   }
-  json_printf(&out, "]");
-  mg_rpc_send_responsef(ri, "%.*s", (int) mb.len, mb.buf);
+  std::vector<const SensorData *> changed;
+  for (const SensorData &sd : s_data) {
+    if (sd.seq > since) changed.push_back(&sd);
+  }
+  bool more = (limit > 0 && (int) changed.size() > limit);
+  auto end = (more ? changed.begin() + limit : changed.end());
+  auto by_seq = [](const SensorData *a, const SensorData *b) {
+    return a->seq < b->seq;
+  };
+  std::partial_sort(changed.begin(), end, changed.end(), by_seq);
+  for (auto it = changed.begin(); it != end; it++) {
+    if (mb.len > 0) json_printf(&out, ", ");
+    hub_data_entry_json(&out, **it);
+  }
+  // If paginating, continue after the last entry returned.
+  uint32_t cursor = (more ? (*(end - 1))->seq : s_seq);
+  mg_rpc_send_responsef(
+      ri, "{epoch: %u, seq: %u, full: %B, more: %B, data: [%.*s]}", s_epoch,
+      cursor, full, more, (int) mb.len, mb.buf);
   mbuf_free(&mb);
 }
 
-static bool parse_data_point(struct mg_rpc_request_info *ri, struct mg_str s,
-                             double default_ts) {
-  bool res = false;
-  int sid = -1, subid = 0;
-  char *name = nullptr;
-  double ts = NAN, value = NAN;
-  json_scanf(s.p, s.len, "{sid: %d, subid: %d, name: %Q, ts: %lf, v: %lf}",
-             &sid, &subid, &name, &ts, &value);
-  mgos::ScopedCPtr name_owner(name);
-
-  if (sid < 0) {
-    mg_rpc_send_errorf(ri, -1, "invalid sid %d/%d", sid, subid);
+// Interns the name without making a heap copy of it first.
+static uint16_t intern_name_token(const struct json_token *t) {
+  if (memchr(t->ptr, '\\', t->len) == nullptr) {
+    return hub_name_intern(t->ptr, t->len);
+  }
+  char buf[256];
+  int len = json_unescape(t->ptr, t->len, buf, sizeof(buf));
+  if (len <= 0) return HUB_NAME_NONE;
+  return hub_name_intern(buf, std::min<size_t>(len, sizeof(buf)));
+}
+
+static bool add_data_point(struct mg_rpc_request_info *ri,
+                           const struct DataPoint *dp, double default_ts) {
+  if (dp->sid < 0) {
+    HUB_COUNTER_INC(rx_errors);
+    mg_rpc_send_errorf(ri, -1, "invalid sid %d/%d", dp->sid, dp->subid);
     return false;
   }
-  if (std::isnan(value)) {
+  if (std::isnan(dp->value)) {
+    HUB_COUNTER_INC(rx_errors);
     mg_rpc_send_errorf(ri, -2, "value is required");
     return false;
   }
+  double ts = dp->ts, sensor_ts = dp->ts;
   if (std::isnan(ts)) {
     if (default_ts > 0) {
-      ts = default_ts;
+      ts = sensor_ts = default_ts;
     } else {
       ts = mg_time();
+      sensor_ts = 0;
     }
   }
 
-  struct SensorData sd(sid, subid, ts, value);
-  if (name != nullptr) {
-    sd.name = name;
+  struct SensorData sd(dp->sid, dp->subid, ts, dp->value);
+  if (hub_dedup_check(&sd, &ri->src, dp->rssi, dp->pc)) {
+    return true;  // Already have it.
+  }
+  if (dp->name.type == JSON_TYPE_STRING) {
+    sd.name_id = intern_name_token(&dp->name);
+  }
+  if (!hub_ratelimit_check(&sd)) {
+    return true;  // Dropped or coalesced.
   }
 
+  hub_stats_rx_begin(sensor_ts);
   hub_add_data(&sd);
+  hub_stats_rx_end();
 
-  res = true;
+  return true;
+}
 
-  return res;
+static bool parse_data_point(struct mg_rpc_request_info *ri, struct mg_str s,
+                             double default_ts) {
+  struct DataPoint dp;
+  json_scanf(s.p, s.len,
+             "{sid: %d, subid: %d, name: %T, ts: %lf, v: %lf, rssi: %d, "
+             "pc: %d}",
+             &dp.sid, &dp.subid, &dp.name, &dp.ts, &dp.value, &dp.rssi,
+             &dp.pc);
+  return add_data_point(ri, &dp, default_ts);
 }
 
 static void hub_sensor_data_handler(struct mg_rpc_request_info *ri,
                                     void *cb_arg UNUSED_ARG,
                                     struct mg_rpc_frame_info *fi UNUSED_ARG,
                                     struct mg_str args) {
+  if (!hub_ratelimit_admit(&ri->src)) {
+    mg_rpc_send_errorf(ri, 429, "too many requests");
+    return;
+  }
   if (!parse_data_point(ri, args, 0)) {
     return;  // Error already sent.
   }
+  HUB_COUNTER_INC(rx_data);
+  hub_stats_add_source_points(&ri->src, 1);
   mg_rpc_send_responsef(ri, NULL);
 }
 
 static void hub_sensor_data_multi_handler(
     struct mg_rpc_request_info *ri, void *cb_arg UNUSED_ARG,
     struct mg_rpc_frame_info *fi UNUSED_ARG, struct mg_str args) {
+  if (!hub_ratelimit_admit(&ri->src)) {
+    mg_rpc_send_errorf(ri, 429, "too many requests");
+    return;
+  }
   double default_ts = 0;
   struct json_token data = JSON_INVALID_TOKEN;
   json_scanf(args.p, args.len, ri->args_fmt, &default_ts, &data);
@@ -232,33 +467,95 @@ static void hub_sensor_data_multi_handler(
     return;
   }
 
-  struct json_token t;
-  for (int i = 0; json_scanf_array_elem(data.ptr, data.len, "", i, &t) > 0;
-       i++) {
-    if (!parse_data_point(ri, mg_mk_str_n(t.ptr, t.len), default_ts)) {
-      return;  // Error already sent.
-    }
-  }
+  bool error = false;
+  int n = hub_data_multi_walk(
+      data.ptr, data.len, [ri, default_ts, &error](const DataPoint &dp) {
+        error = !add_data_point(ri, &dp, default_ts);
+        return !error;
+      });
+  // Points before the invalid one have been added.
+  HUB_COUNTER_ADD(rx_data_multi, n);
+  hub_stats_add_source_points(&ri->src, n);
+  if (error) return;  // Error already sent.
 
   mg_rpc_send_responsef(ri, NULL);
 }
 
+// Binary batch, see hub_data_bin.hpp.
+static void hub_sensor_data_bin_handler(struct mg_rpc_request_info *ri,
+                                        void *cb_arg UNUSED_ARG,
+                                        struct mg_rpc_frame_info *fi UNUSED_ARG,
+                                        struct mg_str args) {
+  if (!hub_ratelimit_admit(&ri->src)) {
+    mg_rpc_send_errorf(ri, 429, "too many requests");
+    return;
+  }
+  struct json_token data = JSON_INVALID_TOKEN;
+  json_scanf(args.p, args.len, ri->args_fmt, &data);
+  if (data.type != JSON_TYPE_STRING) {
+    mg_rpc_send_errorf(ri, -3, "data is required and must be a string");
+    return;
+  }
+  char *buf = static_cast<char *>(malloc(data.len * 3 / 4 + 4));
+  if (buf == nullptr) {
+    mg_rpc_send_errorf(ri, -4, "out of memory");
+    return;
+  }
+  mgos::ScopedCPtr buf_owner(buf);
+  int len = 0;
+  if (cs_base64_decode((const unsigned char *) data.ptr, data.len, buf,
+                       &len) != data.len) {
+    HUB_COUNTER_INC(rx_errors);
+    mg_rpc_send_errorf(ri, -5, "invalid base64");
+    return;
+  }
+  bool error = false;
+  int n = hub_data_bin_decode(
+      (const uint8_t *) buf, len, [ri, &error](const SensorData &sd) {
+        struct DataPoint dp;
+        dp.sid = sd.sid;
+        dp.subid = sd.subid;
+        dp.ts = sd.ts;
+        dp.value = sd.value;
+        error = !add_data_point(ri, &dp, 0);
+        return !error;
+      });
+  if (n < 0) {
+    HUB_COUNTER_INC(rx_errors);
+    mg_rpc_send_errorf(ri, -6, "invalid batch");
+    return;
+  }
+  // Points before the invalid one have been added.
+  HUB_COUNTER_ADD(rx_data_bin, n);
+  hub_stats_add_source_points(&ri->src, n);
+  if (error) return;  // Error already sent.
+  mg_rpc_send_responsef(ri, "{n: %d}", n);
+}
+
 bool hub_data_init(void) {
   struct mg_rpc *c = mgos_rpc_get_global();
-  mg_rpc_add_handler(c, "Hub.Data.List", "", hub_data_list_handler, NULL);
+  mgos_event_register_base(HUB_EV_BASE, "hub");
+  mg_rpc_add_handler(c, "Hub.Data.List", "{since: %u, limit: %d, epoch: %u}",
+                     hub_data_list_handler, NULL);
   mg_rpc_add_handler(c, "Hub.Data.Get", "{sid: %d, subid: %d}",
                      hub_data_get_handler, NULL);
   mg_rpc_add_handler(c, "Hub.Data.Reset", "{sid: %d, subid: %d}",
                      hub_data_reset_handler, NULL);
   mg_rpc_add_handler(c, "Sensor.Data",
-                     "{sid: %d, subid: %d, name: %Q, ts: %lf, v: %lf}",
+                     "{sid: %d, subid: %d, name: %T, ts: %lf, v: %lf, "
+                     "rssi: %d, pc: %d}",
                      hub_sensor_data_handler, NULL);
   mg_rpc_add_handler(c, "Sensor.DataMulti", "{ts: %lf, data: %T}",
                      hub_sensor_data_multi_handler, NULL);
-  hub_data_load(mgos_sys_config_get_hub_data_file());
+  mg_rpc_add_handler(c, "Sensor.DataBin", "{data: %T}",
+                     hub_sensor_data_bin_handler, NULL);
+  // Time survives soft reboots, uptime adds some jitter.
+  s_epoch = (uint32_t) (mg_time() * 1000) ^ (uint32_t) mgos_uptime_micros();
+  hub_data_load();
   if (mgos_sys_config_get_hub_data_save_interval() > 0) {
     mgos_set_timer(mgos_sys_config_get_hub_data_save_interval() * 1000,
                    MGOS_TIMER_REPEAT, hub_data_save_timer_cb, NULL);
   }
+  mgos_event_add_handler(MGOS_EVENT_REBOOT, hub_data_reboot_cb, NULL);
   return true;
 }
@@ -1,7 +1,12 @@
 #pragma once
 
 #include <cstdint>
-#include <string>
+
+#include "mgos_event.h"
+
+#include "hub_sensor_data.hpp"
+
+struct mbuf;
 
 #define UPTIME_SUBID 0
 #define HEAP_FREE_SUBID 1
@@ -9,22 +14,31 @@
 #define TEMP_SUBID 0
 #define RH_SUBID 1
 
-struct SensorData {
-  int sid = -1;
-  int subid = -1;
-  double ts = 0.0;
-  double value = 0.0;
-  std::string name;
-
-  SensorData() = default;
-  SensorData(int sid, int subid, double ts, double value);
-  uint64_t GetKey() const;
-  static uint64_t MakeKey(int sid, int subid);
-  std::string ToString() const;
+#define HUB_EV_BASE MGOS_EVENT_BASE('H', 'U', 'B')
+
+enum hub_event {
+  // New data has been added, ev_data: const struct SensorData *.
+  // The pointer is only valid for the duration of the handler.
+  HUB_EV_DATA = HUB_EV_BASE,
 };
 
 void report_to_server(int sid, int subid, double ts, double value);
 void hub_add_data(const struct SensorData *sd);
-bool hub_get_data(int sid, int subid, struct SensorData *sd);
+// Returns nullptr if there is no data for the sensor.
+// The pointer is only valid until the next data update.
+const struct SensorData *hub_get_data(int sid, int subid);
+
+// Position in the data metrics, see hub_data_metrics().
+struct DataMetricsPos {
+  int family = 0;
+  bool started = false;
+  uint64_t key = 0;  // Last entry appended.
+};
+
+// Current data of all sensors in Prometheus text format, appended up to
+// num entries at a time. pos is advanced, entries added or removed in
+// between are not repeated. Returns false when everything is done.
+bool hub_data_metrics(struct mbuf *out, struct DataMetricsPos *pos,
+                      size_t num);
 
 bool hub_data_init(void);
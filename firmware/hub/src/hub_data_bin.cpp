@@ -0,0 +1,105 @@
+#include "hub_data_bin.hpp"
+
+#include <math.h>
+
+#include "hub_sensor_data.hpp"
+
+#define DATA_BIN_VERSION 1
+#define DATA_BIN_MAX_SCALE 9
+
+static bool read_uvarint(const uint8_t **p, const uint8_t *end, uint64_t *v) {
+  uint64_t res = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (*p == end) return false;
+    uint8_t b = *(*p)++;
+    res |= (uint64_t) (b & 0x7f) << shift;
+    if ((b & 0x80) == 0) {
+      *v = res;
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool read_svarint(const uint8_t **p, const uint8_t *end, int64_t *v) {
+  uint64_t uv;
+  if (!read_uvarint(p, end, &uv)) return false;
+  *v = (int64_t) (uv >> 1) ^ -(int64_t) (uv & 1);
+  return true;
+}
+
+static void write_uvarint(uint64_t v, std::string *out) {
+  while (v >= 0x80) {
+    out->push_back((char) ((v & 0x7f) | 0x80));
+    v >>= 7;
+  }
+  out->push_back((char) v);
+}
+
+static void write_svarint(int64_t v, std::string *out) {
+  write_uvarint(((uint64_t) v << 1) ^ (uint64_t) (v >> 63), out);
+}
+
+static int hub_data_bin_walk(
+    const uint8_t *buf, size_t len,
+    const std::function<bool(const SensorData &sd)> *cb) {
+  const uint8_t *p = buf, *end = buf + len;
+  if (len < 2 || p[0] != DATA_BIN_VERSION || p[1] > DATA_BIN_MAX_SCALE) {
+    return -1;
+  }
+  const double div = pow(10, p[1]);
+  p += 2;
+  uint64_t base_ts_ms, base_sid;
+  if (!read_uvarint(&p, end, &base_ts_ms) ||
+      !read_uvarint(&p, end, &base_sid) || base_sid > INT32_MAX) {
+    return -1;
+  }
+  int64_t sid = base_sid, ts_ms = base_ts_ms;
+  int n = 0;
+  while (p < end) {
+    int64_t sid_delta, ts_delta, value;
+    uint64_t subid;
+    if (!read_svarint(&p, end, &sid_delta) ||
+        !read_uvarint(&p, end, &subid) ||
+        !read_svarint(&p, end, &ts_delta) || !read_svarint(&p, end, &value)) {
+      return -1;
+    }
+    sid += sid_delta;
+    ts_ms += ts_delta;
+    if (sid < 0 || sid > INT32_MAX || subid > INT32_MAX || ts_ms <= 0) {
+      return -1;
+    }
+    if (cb != nullptr) {
+      SensorData sd(sid, subid, ts_ms / 1000.0, value / div);
+      if (!(*cb)(sd)) break;
+    }
+    n++;
+  }
+  return n;
+}
+
+int hub_data_bin_decode(const uint8_t *buf, size_t len,
+                        const std::function<bool(const SensorData &sd)> &cb) {
+  if (hub_data_bin_walk(buf, len, nullptr) < 0) return -1;
+  return hub_data_bin_walk(buf, len, &cb);
+}
+
+void hub_data_bin_encode(const std::vector<SensorData> &points, int scale,
+                         std::string *out) {
+  const double mul = pow(10, scale);
+  int64_t sid = (points.empty() ? 0 : points[0].sid);
+  int64_t ts_ms = (points.empty() ? 0 : llround(points[0].ts * 1000));
+  out->push_back(DATA_BIN_VERSION);
+  out->push_back(scale);
+  write_uvarint(ts_ms, out);
+  write_uvarint(sid, out);
+  for (const SensorData &sd : points) {
+    int64_t pts_ms = llround(sd.ts * 1000);
+    write_svarint(sd.sid - sid, out);
+    write_uvarint(sd.subid, out);
+    write_svarint(pts_ms - ts_ms, out);
+    write_svarint(llround(sd.value * mul), out);
+    sid = sd.sid;
+    ts_ms = pts_ms;
+  }
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+struct SensorData;
+
+// Compact binary batch of data points, accepted by Sensor.DataBin
+// (base64-encoded, as RPC frames are JSON).
+// Header:
+//   u8 version (1), u8 scale, uvarint base_ts_ms, uvarint base_sid.
+// Followed by entries, each relative to the previous one (the first one
+// to the base):
+//   svarint sid delta, uvarint subid, svarint ts delta in milliseconds,
+//   svarint value * 10^scale.
+// uvarint is LEB128, svarint is zigzag-encoded LEB128.
+// A typical entry takes 5-7 bytes, vs ~50 of JSON (see
+// test/bench_data_bin.cpp). Names are not supported.
+
+// Decodes the batch, invoking cb for each point. Stops if cb returns false.
+// The whole batch is checked first, cb is not invoked if it is invalid.
+// Returns the number of points cb has accepted or -1 if the batch is invalid.
+int hub_data_bin_decode(const uint8_t *buf, size_t len,
+                        const std::function<bool(const SensorData &sd)> &cb);
+
+// Encodes points as a batch. Values are rounded to scale decimal digits.
+void hub_data_bin_encode(const std::vector<SensorData> &points, int scale,
+                         std::string *out);
@@ -0,0 +1,79 @@
+#include "hub_data_log.hpp"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "mgos.h"
+
+#include "hub_data.hpp"
+
+#define DATA_LOG_MAGIC "HDL3"
+#define DATA_LOG_MAGIC_LEN 4
+#define DATA_LOG_REC_LEN 28
+
+static void fletcher16_update(uint16_t *s1, uint16_t *s2, const uint8_t *data,
+                              size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    *s1 = (*s1 + data[i]) % 255;
+    *s2 = (*s2 + *s1) % 255;
+  }
+}
+
+// Checksum of the record, skipping the checksum field itself.
+static uint16_t record_checksum(const uint8_t *rec) {
+  uint16_t s1 = 0, s2 = 0;
+  fletcher16_update(&s1, &s2, rec, 2);
+  fletcher16_update(&s1, &s2, rec + 4, DATA_LOG_REC_LEN - 4);
+  return (s2 << 8) | s1;
+}
+
+bool hub_data_log_write_header(FILE *fp) {
+  return (fwrite(DATA_LOG_MAGIC, DATA_LOG_MAGIC_LEN, 1, fp) == 1);
+}
+
+bool hub_data_log_write_record(FILE *fp, const struct SensorData &sd) {
+  uint8_t buf[DATA_LOG_REC_LEN];
+  int32_t sid = sd.sid, subid = sd.subid;
+  memcpy(buf, &sd.name_id, 2);
+  memcpy(buf + 4, &sid, 4);
+  memcpy(buf + 8, &subid, 4);
+  memcpy(buf + 12, &sd.ts, 8);
+  memcpy(buf + 20, &sd.value, 8);
+  uint16_t cs = record_checksum(buf);
+  memcpy(buf + 2, &cs, 2);
+  return (fwrite(buf, DATA_LOG_REC_LEN, 1, fp) == 1);
+}
+
+int hub_data_log_read(const char *fn,
+                      const std::function<void(struct SensorData *sd)> &cb) {
+  FILE *fp = fopen(fn, "rb");
+  if (fp == NULL) return -1;
+  int n = 0;
+  uint8_t buf[DATA_LOG_REC_LEN];
+  if (fread(buf, DATA_LOG_MAGIC_LEN, 1, fp) != 1 ||
+      memcmp(buf, DATA_LOG_MAGIC, DATA_LOG_MAGIC_LEN) != 0) {
+    fclose(fp);
+    return -1;
+  }
+  while (fread(buf, DATA_LOG_REC_LEN, 1, fp) == 1) {
+    uint16_t cs;
+    memcpy(&cs, buf + 2, 2);
+    if (record_checksum(buf) != cs) {
+      LOG(LL_ERROR, ("%s: bad record at %d", fn, n));
+      break;
+    }
+    struct SensorData sd;
+    int32_t sid, subid;
+    memcpy(&sid, buf + 4, 4);
+    memcpy(&subid, buf + 8, 4);
+    memcpy(&sd.ts, buf + 12, 8);
+    memcpy(&sd.value, buf + 20, 8);
+    sd.sid = sid;
+    sd.subid = subid;
+    memcpy(&sd.name_id, buf, 2);
+    cb(&sd);
+    n++;
+  }
+  fclose(fp);
+  return n;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdio.h>
+
+#include <functional>
+
+struct SensorData;
+
+// Binary data record file, used for both the snapshot and the change log.
+// File starts with a 4-byte magic, followed by records:
+//   u16 name_id, u16 checksum, i32 sid, i32 subid, f64 ts, f64 value.
+// Checksum (Fletcher-16) covers the rest of the record, a record that fails
+// it (e.g. one partially written due to power loss) ends the file.
+// Names are stored separately, see hub_names.hpp.
+
+bool hub_data_log_write_header(FILE *fp);
+bool hub_data_log_write_record(FILE *fp, const struct SensorData &sd);
+
+// Reads records from the file, invoking cb for each.
+// Returns the number of records read or -1 if the file does not exist
+// or is not a data log file.
+int hub_data_log_read(const char *fn,
+                      const std::function<void(struct SensorData *sd)> &cb);
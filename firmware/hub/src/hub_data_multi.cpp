@@ -0,0 +1,77 @@
+#include "hub_data_multi.hpp"
+
+#include <cstdlib>
+#include <cstring>
+
+struct DataMultiWalk {
+  const std::function<bool(const DataPoint &dp)> *cb = nullptr;
+  // Number of containers open: 1 is the array, 2 is a data point.
+  int depth = 0;
+  struct DataPoint dp;
+  int num_added = 0;
+  bool stop = false;
+};
+
+static bool field_is(const char *name, size_t name_len, const char *field) {
+  return (strlen(field) == name_len && memcmp(name, field, name_len) == 0);
+}
+
+// Numbers are always followed by a delimiter within the array.
+static void data_point_field(struct DataPoint *dp, const char *name,
+                             size_t name_len, const struct json_token *t) {
+  if (t->type == JSON_TYPE_NUMBER) {
+    if (field_is(name, name_len, "sid")) {
+      dp->sid = strtol(t->ptr, nullptr, 10);
+    } else if (field_is(name, name_len, "subid")) {
+      dp->subid = strtol(t->ptr, nullptr, 10);
+    } else if (field_is(name, name_len, "ts")) {
+      dp->ts = strtod(t->ptr, nullptr);
+    } else if (field_is(name, name_len, "v")) {
+      dp->value = strtod(t->ptr, nullptr);
+    } else if (field_is(name, name_len, "rssi")) {
+      dp->rssi = strtol(t->ptr, nullptr, 10);
+    } else if (field_is(name, name_len, "pc")) {
+      dp->pc = strtol(t->ptr, nullptr, 10);
+    }
+  } else if (t->type == JSON_TYPE_STRING && field_is(name, name_len, "name")) {
+    dp->name = *t;
+  }
+}
+
+static void data_multi_walk_cb(void *arg, const char *name, size_t name_len,
+                               const char *path, const struct json_token *t) {
+  struct DataMultiWalk *w = static_cast<struct DataMultiWalk *>(arg);
+  (void) path;
+  if (w->stop) return;
+  switch (t->type) {
+    case JSON_TYPE_OBJECT_START:
+    case JSON_TYPE_ARRAY_START:
+      if (w->depth == 1) w->dp = DataPoint();
+      w->depth++;
+      return;
+    case JSON_TYPE_OBJECT_END:
+    case JSON_TYPE_ARRAY_END:
+      w->depth--;
+      break;
+    default:
+      if (w->depth == 2) data_point_field(&w->dp, name, name_len, t);
+      if (w->depth != 1) return;
+      // Not an object, will be rejected.
+      w->dp = DataPoint();
+      break;
+  }
+  if (w->depth != 1) return;
+  if (!(*w->cb)(w->dp)) {
+    w->stop = true;
+    return;
+  }
+  w->num_added++;
+}
+
+int hub_data_multi_walk(const char *data, size_t len,
+                        const std::function<bool(const DataPoint &dp)> &cb) {
+  struct DataMultiWalk w;
+  w.cb = &cb;
+  json_walk(data, len, data_multi_walk_cb, &w);
+  return w.num_added;
+}
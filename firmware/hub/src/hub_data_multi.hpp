@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <functional>
+
+#include "frozen.h"
+
+#include "hub_dedup.hpp"
+
+// A data point as received, before validation.
+// Name is a view into the request, not unescaped yet.
+struct DataPoint {
+  int sid = -1;
+  int subid = 0;
+  struct json_token name = JSON_INVALID_TOKEN;
+  double ts = NAN;
+  double value = NAN;
+  // Set by relays, for deduplication.
+  int rssi = HUB_DEDUP_NO_RSSI;
+  int pc = HUB_DEDUP_NO_PC;
+};
+
+// Decodes the Sensor.DataMulti data array in a single pass, invoking cb for
+// each element as it ends. Unknown fields, including nested ones, are
+// ignored. An element that is not an object is passed with no sid, to be
+// rejected. Stops when cb returns false.
+// Returns the number of elements cb has accepted.
+int hub_data_multi_walk(const char *data, size_t len,
+                        const std::function<bool(const DataPoint &dp)> &cb);
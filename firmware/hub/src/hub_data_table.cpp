@@ -0,0 +1,73 @@
+#include "hub_data_table.hpp"
+
+#include <algorithm>
+
+size_t SensorTable::size() const {
+  return keys_.size();
+}
+
+bool SensorTable::empty() const {
+  return keys_.empty();
+}
+
+size_t SensorTable::LowerBound(uint64_t key) const {
+  return std::lower_bound(keys_.begin(), keys_.end(), key) - keys_.begin();
+}
+
+SensorData *SensorTable::Find(uint64_t key) {
+  size_t i = LowerBound(key);
+  if (i == keys_.size() || keys_[i] != key) return nullptr;
+  return &entries_[i];
+}
+
+const SensorData *SensorTable::Find(uint64_t key) const {
+  size_t i = LowerBound(key);
+  if (i == keys_.size() || keys_[i] != key) return nullptr;
+  return &entries_[i];
+}
+
+SensorTable::const_iterator SensorTable::UpperBound(uint64_t key) const {
+  return entries_.begin() +
+         (std::upper_bound(keys_.begin(), keys_.end(), key) - keys_.begin());
+}
+
+SensorData *SensorTable::FindOrInsert(uint64_t key, bool *inserted) {
+  size_t i = LowerBound(key);
+  if (i < keys_.size() && keys_[i] == key) {
+    *inserted = false;
+    return &entries_[i];
+  }
+  keys_.insert(keys_.begin() + i, key);
+  entries_.emplace(entries_.begin() + i);
+  *inserted = true;
+  return &entries_[i];
+}
+
+bool SensorTable::Erase(uint64_t key) {
+  size_t i = LowerBound(key);
+  if (i == keys_.size() || keys_[i] != key) return false;
+  keys_.erase(keys_.begin() + i);
+  entries_.erase(entries_.begin() + i);
+  return true;
+}
+
+void SensorTable::Clear() {
+  keys_.clear();
+  entries_.clear();
+}
+
+SensorTable::iterator SensorTable::begin() {
+  return entries_.begin();
+}
+
+SensorTable::iterator SensorTable::end() {
+  return entries_.end();
+}
+
+SensorTable::const_iterator SensorTable::begin() const {
+  return entries_.begin();
+}
+
+SensorTable::const_iterator SensorTable::end() const {
+  return entries_.end();
+}
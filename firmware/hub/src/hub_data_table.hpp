@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "hub_sensor_data.hpp"
+
+// Sensor data table: a flat vector of entries sorted by key.
+// Lookups are a binary search over a dense array of keys, iteration is
+// in key order. Insertion and removal invalidate pointers to entries.
+class SensorTable {
+ public:
+  typedef std::vector<SensorData>::iterator iterator;
+  typedef std::vector<SensorData>::const_iterator const_iterator;
+
+  size_t size() const;
+  bool empty() const;
+
+  SensorData *Find(uint64_t key);
+  const SensorData *Find(uint64_t key) const;
+  // First entry with a key greater than key.
+  const_iterator UpperBound(uint64_t key) const;
+  // Returns the existing entry or inserts a new, empty one.
+  SensorData *FindOrInsert(uint64_t key, bool *inserted);
+  bool Erase(uint64_t key);
+  void Clear();
+
+  iterator begin();
+  iterator end();
+  const_iterator begin() const;
+  const_iterator end() const;
+
+ private:
+  size_t LowerBound(uint64_t key) const;
+
+  std::vector<uint64_t> keys_;
+  std::vector<SensorData> entries_;
+};
@@ -0,0 +1,112 @@
+#include "hub_dedup.hpp"
+
+#include <cmath>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "mgos.hpp"
+#include "mgos_rpc.h"
+
+#include "hub_data.hpp"
+#include "hub_stats.hpp"
+
+#define NO_RELAY 0xff
+
+struct DedupEntry {
+  // Last accepted point.
+  double ts = 0;
+  double value = NAN;
+  int pc = HUB_DEDUP_NO_PC;
+  uint8_t src = NO_RELAY;
+  // Preferred relay, its last RSSI and when it was last heard from.
+  uint8_t relay = NO_RELAY;
+  int8_t relay_rssi = 0;
+  double relay_uts = 0;
+};
+
+// Sources are few (relays), entries refer to them by index.
+static std::vector<std::string> s_sources;
+static std::map<uint64_t, DedupEntry> s_entries;
+
+static uint8_t get_source_idx(const struct mg_str *src) {
+  for (size_t i = 0; i < s_sources.size(); i++) {
+    if (mg_vcmp(src, s_sources[i].c_str()) == 0) return i;
+  }
+  if (s_sources.size() >= NO_RELAY) return NO_RELAY;
+  s_sources.emplace_back(src->p, src->len);
+  return s_sources.size() - 1;
+}
+
+bool hub_dedup_check(const struct SensorData *sd, const struct mg_str *src,
+                     int rssi, int pc) {
+  if (!mgos_sys_config_get_hub_dedup_enable()) return false;
+  const double now = mgos_uptime();
+  const uint8_t si = get_source_idx(src);
+  DedupEntry &e = s_entries[sd->GetKey()];
+
+  if (rssi != HUB_DEDUP_NO_RSSI && si != NO_RELAY) {
+    const int hysteresis = mgos_sys_config_get_hub_dedup_rssi_hysteresis();
+    const int timeout = mgos_sys_config_get_hub_dedup_relay_timeout();
+    if (e.relay == NO_RELAY || now - e.relay_uts > timeout ||
+        (si != e.relay && rssi > e.relay_rssi + hysteresis)) {
+      if (e.relay != si) {
+        LOG(LL_DEBUG, ("%d/%d: relay %s (%d)", sd->sid, sd->subid,
+                       s_sources[si].c_str(), rssi));
+      }
+      e.relay = si;
+    }
+    if (si == e.relay) {
+      e.relay_rssi = rssi;
+      e.relay_uts = now;
+    } else {
+      HUB_COUNTER_INC(rx_relay_dropped);
+      return true;
+    }
+  }
+
+  // Counter may repeat after a reboot or wrap, only trust it within window.
+  const double window = mgos_sys_config_get_hub_dedup_window();
+  const bool in_window = (std::fabs(sd->ts - e.ts) <= window);
+  bool dup;
+  if (pc != HUB_DEDUP_NO_PC) {
+    dup = (pc == e.pc && in_window);
+  } else {
+    dup = (si != e.src && sd->value == e.value && in_window);
+  }
+  if (dup) {
+    HUB_COUNTER_INC(rx_dup);
+    return true;
+  }
+  e.ts = sd->ts;
+  e.value = sd->value;
+  e.pc = pc;
+  e.src = si;
+  return false;
+}
+
+static void hub_data_relays_handler(struct mg_rpc_request_info *ri,
+                                    void *cb_arg UNUSED_ARG,
+                                    struct mg_rpc_frame_info *fi UNUSED_ARG,
+                                    struct mg_str args UNUSED_ARG) {
+  const double now = mgos_uptime();
+  struct mbuf mb;
+  mbuf_init(&mb, 50);
+  struct json_out out = JSON_OUT_MBUF(&mb);
+  for (const auto &it : s_entries) {
+    const DedupEntry &e = it.second;
+    if (e.relay == NO_RELAY) continue;
+    if (mb.len > 0) json_printf(&out, ", ");
+    json_printf(&out, "{sid: %d, subid: %d, relay: %Q, rssi: %d, age: %.0lf}",
+                (int) (it.first >> 32), (int) (it.first & 0xffffffff),
+                s_sources[e.relay].c_str(), e.relay_rssi, now - e.relay_uts);
+  }
+  mg_rpc_send_responsef(ri, "[%.*s]", (int) mb.len, mb.buf);
+  mbuf_free(&mb);
+}
+
+bool hub_dedup_init(void) {
+  mg_rpc_add_handler(mgos_rpc_get_global(), "Hub.Data.Relays", "",
+                     hub_data_relays_handler, NULL);
+  return true;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+struct SensorData;
+struct mg_str;
+
+#define HUB_DEDUP_NO_RSSI 0
+#define HUB_DEDUP_NO_PC -1
+
+// Drops points that have already been received via another relay.
+// A point is a duplicate if it is within hub.dedup.window of the last
+// accepted one and carries the same packet counter (pc) or, if there is no
+// counter, has the same value and arrived from a different source.
+// If points carry RSSI, one relay is preferred for each sensor: the one
+// with the best signal, with some hysteresis. Other relays' points are
+// dropped until it goes quiet for hub.dedup.relay_timeout.
+// Returns true if the point should be dropped.
+bool hub_dedup_check(const struct SensorData *sd, const struct mg_str *src,
+                     int rssi, int pc);
+
+bool hub_dedup_init(void);
@@ -0,0 +1,256 @@
+#include "hub_history.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <map>
+
+#include "mgos.hpp"
+#include "mgos_rpc.h"
+
+#include "hub_data.hpp"
+#include "hub_tsblock.hpp"
+
+// History is kept as a list of compressed blocks per sensor.
+// All sensors share the memory budget: when it is exhausted, the block with
+// the oldest data is evicted.
+// Points older than the last one of the sensor (e.g. a backlog flushed by
+// a relay) are queued and merged in batches, so a backfill re-encodes the
+// affected blocks once rather than once per point. Only the most recent
+// blocks are re-encoded, late points that fall before them are dropped.
+struct HistoryStats {
+  unsigned int added = 0;
+  unsigned int dropped = 0;
+  unsigned int out_of_order = 0;
+  unsigned int merges = 0;
+  unsigned int evicted = 0;
+};
+
+// Merge is forced when this many late points are queued.
+#define HISTORY_MAX_LATE 1024
+// At most this many blocks of a sensor are decoded by a merge.
+#define HISTORY_MAX_MERGE_BLOCKS 4
+
+static std::map<uint64_t, std::deque<TSBlock>> s_history;
+static std::map<uint64_t, std::vector<HistoryPoint>> s_late;
+static size_t s_num_late = 0;
+static size_t s_mem_used = 0;
+static HistoryStats s_stats;
+static mgos_timer_id s_merge_timer_id = MGOS_INVALID_TIMER_ID;
+
+// Evicts the oldest block of any sensor that has more than one.
+static bool hub_history_evict_oldest(void) {
+  std::deque<TSBlock> *oldest = nullptr;
+  for (auto &e : s_history) {
+    std::deque<TSBlock> &blocks = e.second;
+    if (blocks.size() < 2) continue;
+    if (oldest == nullptr ||
+        blocks.front().last_ts() < oldest->front().last_ts()) {
+      oldest = &blocks;
+    }
+  }
+  if (oldest == nullptr) return false;
+  s_mem_used -= oldest->front().GetMemoryUsage();
+  oldest->pop_front();
+  s_stats.evicted++;
+  return true;
+}
+
+static bool hub_history_new_block(std::deque<TSBlock> *blocks) {
+  const size_t block_size = mgos_sys_config_get_hub_history_block_size();
+  const size_t max_size = mgos_sys_config_get_hub_history_max_size();
+  const size_t size = sizeof(TSBlock) + block_size;
+  while (s_mem_used + size > max_size) {
+    if (hub_history_evict_oldest()) continue;
+    // Nothing else to evict, recycle our own oldest block.
+    if (blocks->empty()) return false;
+    s_mem_used -= blocks->front().GetMemoryUsage();
+    blocks->pop_front();
+    s_stats.evicted++;
+  }
+  blocks->emplace_back(block_size);
+  s_mem_used += blocks->back().GetMemoryUsage();
+  return true;
+}
+
+static bool hub_history_append(std::deque<TSBlock> *blocks, double ts,
+                               double value) {
+  if (!blocks->empty() && blocks->back().Append(ts, value)) return true;
+  return (hub_history_new_block(blocks) && blocks->back().Append(ts, value));
+}
+
+// Re-encodes the blocks that overlap with late points, merging them in.
+// Existing points win over late ones with the same timestamp.
+static void hub_history_merge(std::deque<TSBlock> *blocks,
+                              std::vector<HistoryPoint> *late) {
+  const auto ts_less = [](const HistoryPoint &a, const HistoryPoint &b) {
+    return a.ts < b.ts;
+  };
+  for (HistoryPoint &p : *late) p.ts = std::round(p.ts);
+  std::stable_sort(late->begin(), late->end(), ts_less);
+  size_t first = blocks->size();
+  const size_t min_first = (first > HISTORY_MAX_MERGE_BLOCKS
+                                ? first - HISTORY_MAX_MERGE_BLOCKS
+                                : 0);
+  while (first > min_first &&
+         (*blocks)[first - 1].last_ts() >= late->front().ts) {
+    first--;
+  }
+  if (first > 0) {
+    // Points not after the last kept block would require decoding it too.
+    const double min_ts = (*blocks)[first - 1].last_ts();
+    const auto it = std::upper_bound(
+        late->begin(), late->end(), HistoryPoint{min_ts, 0}, ts_less);
+    s_stats.dropped += it - late->begin();
+    late->erase(late->begin(), it);
+    if (late->empty()) return;
+  }
+  std::vector<HistoryPoint> cur;
+  for (size_t i = first; i < blocks->size(); i++) {
+    double ts, value;
+    TSBlock::Reader r((*blocks)[i]);
+    while (r.Next(&ts, &value)) cur.push_back({ts, value});
+    s_mem_used -= (*blocks)[i].GetMemoryUsage();
+  }
+  blocks->erase(blocks->begin() + first, blocks->end());
+  std::vector<HistoryPoint> merged;
+  merged.reserve(cur.size() + late->size());
+  // Existing points are all kept, even those that share a timestamp.
+  // A late point is dropped if it has the timestamp of an existing point
+  // or of an earlier late one.
+  auto cit = cur.begin();
+  size_t num_added = 0;
+  for (const HistoryPoint &p : *late) {
+    while (cit != cur.end() && cit->ts < p.ts) merged.push_back(*cit++);
+    if (cit != cur.end() && cit->ts == p.ts) continue;
+    if (!merged.empty() && merged.back().ts == p.ts) continue;
+    merged.push_back(p);
+    num_added++;
+  }
+  merged.insert(merged.end(), cit, cur.end());
+  s_stats.added += num_added;
+  s_stats.dropped += late->size() - num_added;
+  for (const HistoryPoint &p : merged) {
+    // Cannot fail unless the budget is less than a block.
+    if (!hub_history_append(blocks, p.ts, p.value)) s_stats.dropped++;
+  }
+  s_stats.merges++;
+}
+
+static void hub_history_merge_late(void) {
+  for (auto &e : s_late) {
+    hub_history_merge(&s_history[e.first], &e.second);
+  }
+  s_late.clear();
+  s_num_late = 0;
+}
+
+static void hub_history_merge_timer_cb(void *arg UNUSED_ARG) {
+  s_merge_timer_id = MGOS_INVALID_TIMER_ID;
+  hub_history_merge_late();
+}
+
+void hub_history_add(const struct SensorData *sd) {
+  if (!mgos_sys_config_get_hub_history_enable()) return;
+  std::deque<TSBlock> &blocks = s_history[sd->GetKey()];
+  if (!blocks.empty() && std::round(sd->ts) < blocks.back().last_ts()) {
+    s_stats.out_of_order++;
+    if (std::round(sd->ts) < blocks.front().first_ts()) {
+      // Older than anything we keep, it would be evicted first anyway.
+      s_stats.dropped++;
+      return;
+    }
+    s_late[sd->GetKey()].push_back({sd->ts, sd->value});
+    if (++s_num_late >= HISTORY_MAX_LATE) {
+      hub_history_merge_late();
+    } else if (s_merge_timer_id == MGOS_INVALID_TIMER_ID) {
+      s_merge_timer_id =
+          mgos_set_timer(mgos_sys_config_get_hub_history_merge_delay_ms(), 0,
+                         hub_history_merge_timer_cb, NULL);
+    }
+    return;
+  }
+  if (!hub_history_append(&blocks, sd->ts, sd->value)) {
+    s_stats.dropped++;
+    return;
+  }
+  s_stats.added++;
+}
+
+bool hub_history_get(int sid, int subid, double from, double to, int limit,
+                     std::vector<HistoryPoint> *points) {
+  const auto it = s_history.find(SensorData::MakeKey(sid, subid));
+  if (it == s_history.end()) return false;
+  for (const TSBlock &b : it->second) {
+    if (b.last_ts() < from) continue;
+    if (b.first_ts() >= to) break;
+    double ts, value;
+    TSBlock::Reader r(b);
+    while ((int) points->size() < limit && r.Next(&ts, &value)) {
+      if (ts < from) continue;
+      if (ts >= to) break;
+      points->push_back({ts, value});
+    }
+  }
+  return true;
+}
+
+static void hub_data_history_handler(struct mg_rpc_request_info *ri,
+                                     void *cb_arg UNUSED_ARG,
+                                     struct mg_rpc_frame_info *fi UNUSED_ARG,
+                                     struct mg_str args) {
+  int sid = -1, subid = 0, limit = 100;
+  double from = 0, to = INFINITY;
+  json_scanf(args.p, args.len, ri->args_fmt, &sid, &subid, &from, &to,
+             &limit);
+
+  std::vector<HistoryPoint> points;
+  if (!hub_history_get(sid, subid, from, to, limit, &points)) {
+    mg_rpc_send_errorf(ri, 404, "no history for %d/%d", sid, subid);
+    return;
+  }
+
+  struct mbuf mb;
+  mbuf_init(&mb, 50);
+  struct json_out out = JSON_OUT_MBUF(&mb);
+  for (const HistoryPoint &p : points) {
+    if (mb.len > 0) json_printf(&out, ", ");
+    json_printf(&out, "{ts: %.3lf, v: %.3lf}", p.ts, p.value);
+  }
+  mg_rpc_send_responsef(ri, "{sid: %d, subid: %d, data: [%.*s]}", sid, subid,
+                        (int) mb.len, mb.buf);
+  mbuf_free(&mb);
+}
+
+static void hub_data_history_status_handler(
+    struct mg_rpc_request_info *ri, void *cb_arg UNUSED_ARG,
+    struct mg_rpc_frame_info *fi UNUSED_ARG, struct mg_str args UNUSED_ARG) {
+  int num_blocks = 0, num_points = 0, data_size = 0;
+  for (const auto &e : s_history) {
+    for (const TSBlock &b : e.second) {
+      num_blocks++;
+      num_points += b.count();
+      data_size += b.data_size();
+    }
+  }
+  mg_rpc_send_responsef(ri,
+                        "{sensors: %d, blocks: %d, points: %d, data_size: %d, "
+                        "mem_used: %d, added: %u, dropped: %u, "
+                        "out_of_order: %u, pending: %d, merges: %u, "
+                        "evicted: %u}",
+                        (int) s_history.size(), num_blocks, num_points,
+                        data_size, (int) s_mem_used, s_stats.added,
+                        s_stats.dropped, s_stats.out_of_order,
+                        (int) s_num_late, s_stats.merges, s_stats.evicted);
+}
+
+bool hub_history_init(void) {
+  struct mg_rpc *c = mgos_rpc_get_global();
+  mg_rpc_add_handler(c, "Hub.Data.History",
+                     "{sid: %d, subid: %d, from: %lf, to: %lf, limit: %d}",
+                     hub_data_history_handler, NULL);
+  mg_rpc_add_handler(c, "Hub.Data.HistoryStatus", "",
+                     hub_data_history_status_handler, NULL);
+  return true;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <vector>
+
+struct SensorData;
+
+struct HistoryPoint {
+  double ts;
+  double value;
+};
+
+void hub_history_add(const struct SensorData *sd);
+
+// Returns up to limit points with from <= ts < to, oldest first.
+bool hub_history_get(int sid, int subid, double from, double to, int limit,
+                     std::vector<HistoryPoint> *points);
+
+bool hub_history_init(void);
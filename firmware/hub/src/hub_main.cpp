@@ -12,6 +12,15 @@
 
 #include "hub_control.hpp"
 #include "hub_data.hpp"
+#include "hub_dedup.hpp"
+#include "hub_history.hpp"
+#include "hub_names.hpp"
+#include "hub_ratelimit.hpp"
+#include "hub_report.hpp"
+#include "hub_rollup.hpp"
+#include "hub_spool.hpp"
+#include "hub_stats.hpp"
+#include "hub_subscribe.hpp"
 
 static int s_sl_gpio = -1;
 
@@ -32,7 +41,7 @@ static void status_timer_cb(void *arg UNUSED_ARG) {
     int ths = (last_heater_action_ts > 0 ? now - last_heater_action_ts : -1);
     LOG(LL_INFO,
         ("Heater %s (last action %d ago)", (heater_on ? "on" : "off"), ths));
-    HubControlReportOutputs();
+    HubControlReportState();
   }
   report_to_server(sys_sid, UPTIME_SUBID, now, mgos_uptime());
   report_to_server(sys_sid, HEAP_FREE_SUBID, now, mgos_get_free_heap_size());
@@ -55,6 +64,46 @@ static void status_timer_cb(void *arg UNUSED_ARG) {
 enum mgos_app_init_result mgos_app_init(void) {
   enum mgos_app_init_result res = MGOS_APP_INIT_ERROR;
 
+  if (!hub_stats_init()) {
+    LOG(LL_ERROR, ("Stats module init failed"));
+    goto out;
+  }
+
+  if (!hub_spool_init()) {
+    LOG(LL_ERROR, ("Spool module init failed"));
+    goto out;
+  }
+
+  if (!hub_report_init()) {
+    LOG(LL_ERROR, ("Report module init failed"));
+    goto out;
+  }
+
+  if (!hub_history_init()) {
+    LOG(LL_ERROR, ("History module init failed"));
+    goto out;
+  }
+
+  if (!hub_rollup_init()) {
+    LOG(LL_ERROR, ("Rollup module init failed"));
+    goto out;
+  }
+
+  if (!hub_names_init()) {
+    LOG(LL_ERROR, ("Names module init failed"));
+    goto out;
+  }
+
+  if (!hub_dedup_init()) {
+    LOG(LL_ERROR, ("Dedup module init failed"));
+    goto out;
+  }
+
+  if (!hub_ratelimit_init()) {
+    LOG(LL_ERROR, ("Rate limit module init failed"));
+    goto out;
+  }
+
   if (!hub_data_init()) {
     LOG(LL_ERROR, ("Data module init failed"));
     goto out;
@@ -65,6 +114,11 @@ enum mgos_app_init_result mgos_app_init(void) {
     goto out;
   }
 
+  if (!hub_subscribe_init()) {
+    LOG(LL_ERROR, ("Subscribe module init failed"));
+    goto out;
+  }
+
   if (mgos_sys_config_get_hub_status_interval() > 0) {
     s_sl_gpio = mgos_sys_config_get_hub_status_led_gpio();
     if (s_sl_gpio >= 0) {
@@ -0,0 +1,82 @@
+#include "hub_name_pool.hpp"
+
+#include <string.h>
+
+#include <algorithm>
+
+#define NAMES_CHUNK_SIZE 256
+
+static uint32_t name_hash(const char *name, size_t len) {
+  uint32_t h = 2166136261U;  // FNV-1a
+  for (size_t i = 0; i < len; i++) {
+    h = (h ^ (uint8_t) name[i]) * 16777619U;
+  }
+  return h;
+}
+
+NamePool::NamePool() : chunk_used_(NAMES_CHUNK_SIZE), names_({""}) {
+}
+
+int NamePool::FindSlot(const char *name, size_t len) const {
+  const size_t mask = index_.size() - 1;
+  size_t i = name_hash(name, len) & mask;
+  while (index_[i] != HUB_NAME_NONE) {
+    const char *n = names_[index_[i]];
+    if (strncmp(n, name, len) == 0 && n[len] == '\0') return index_[i];
+    i = (i + 1) & mask;
+  }
+  return -1 - (int) i;
+}
+
+void NamePool::GrowIndex() {
+  index_.assign(std::max<size_t>(index_.size() * 2, 64), HUB_NAME_NONE);
+  for (size_t id = 1; id < names_.size(); id++) {
+    const char *n = names_[id];
+    int slot = FindSlot(n, strlen(n));
+    if (slot < 0) index_[-1 - slot] = id;
+  }
+}
+
+uint16_t NamePool::Find(const char *name, size_t len) const {
+  if (len == 0 || index_.empty()) return HUB_NAME_NONE;
+  int id = FindSlot(name, len);
+  return (id >= 0 ? id : HUB_NAME_NONE);
+}
+
+uint16_t NamePool::Add(const char *name, size_t len, size_t max_size) {
+  if (names_.size() > UINT16_MAX || len >= NAMES_CHUNK_SIZE) {
+    return HUB_NAME_NONE;
+  }
+  if (chunk_used_ + len + 1 > NAMES_CHUNK_SIZE) {
+    if (mem_used_ + NAMES_CHUNK_SIZE > max_size) return HUB_NAME_NONE;
+    chunks_.emplace_back(new char[NAMES_CHUNK_SIZE]);
+    chunk_used_ = 0;
+    mem_used_ += NAMES_CHUNK_SIZE;
+  }
+  char *n = chunks_.back().get() + chunk_used_;
+  memcpy(n, name, len);
+  n[len] = '\0';
+  chunk_used_ += len + 1;
+  uint16_t id = names_.size();
+  names_.push_back(n);
+  if (names_.size() * 2 > index_.size()) {
+    GrowIndex();
+  } else {
+    int slot = FindSlot(n, len);
+    if (slot < 0) index_[-1 - slot] = id;
+  }
+  return id;
+}
+
+const char *NamePool::Get(uint16_t id) const {
+  if (id >= names_.size()) return "";
+  return names_[id];
+}
+
+size_t NamePool::size() const {
+  return names_.size();
+}
+
+size_t NamePool::mem_used() const {
+  return mem_used_;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "hub_names.hpp"
+
+// Storage of the name pool, see hub_names.hpp.
+// Names are NUL-terminated and packed into fixed-size chunks that are never
+// moved or freed, so pointers to them remain valid. An open addressing hash
+// index maps names to IDs. ID 0 (HUB_NAME_NONE) is the empty name.
+class NamePool {
+ public:
+  NamePool();
+
+  // Returns HUB_NAME_NONE if the name is not in the pool.
+  uint16_t Find(const char *name, size_t len) const;
+  // Adds the name, which gets the next ID. Does not check if the name is
+  // already in the pool: IDs are positional when loading.
+  // Returns HUB_NAME_NONE if there are no IDs left or allocating another
+  // chunk would take memory usage over max_size.
+  uint16_t Add(const char *name, size_t len, size_t max_size);
+  // Returns "" if there is no such ID.
+  const char *Get(uint16_t id) const;
+
+  // Number of IDs allocated, including the empty name.
+  size_t size() const;
+  size_t mem_used() const;
+
+ private:
+  // Returns the ID of the name or the index of the empty slot to insert it
+  // at, as a negative number.
+  int FindSlot(const char *name, size_t len) const;
+  void GrowIndex();
+
+  std::vector<std::unique_ptr<char[]>> chunks_;
+  size_t chunk_used_;
+  std::vector<const char *> names_;
+  // HUB_NAME_NONE marks an empty slot.
+  std::vector<uint16_t> index_;
+  size_t mem_used_ = 0;
+};
@@ -0,0 +1,145 @@
+#include "hub_names.hpp"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+
+#include "mgos.hpp"
+#include "mgos_rpc.h"
+
+#include "hub_name_pool.hpp"
+
+// Names file: 4-byte magic followed by u8 len + name for each ID, in order.
+#define NAMES_FILE_MAGIC "HNP1"
+#define NAMES_FILE_MAGIC_LEN 4
+#define NAMES_MAX_LEN 255
+
+struct NamesStats {
+  unsigned int added = 0;
+  unsigned int full = 0;
+};
+
+static NamePool s_pool;
+static long s_file_size = 0;
+static bool s_flush_pending = false;
+static NamesStats s_stats;
+
+static uint16_t hub_names_add(const char *name, size_t len) {
+  return s_pool.Add(name, len, mgos_sys_config_get_hub_names_max_size());
+}
+
+static bool hub_names_write_record(FILE *fp, const char *name) {
+  uint8_t len = strlen(name);
+  return (fwrite(&len, 1, 1, fp) == 1 &&
+          (len == 0 || fwrite(name, len, 1, fp) == 1));
+}
+
+static bool hub_names_append(uint16_t id) {
+  const char *fn = mgos_sys_config_get_hub_names_file();
+  if (fn == NULL) return true;
+  if (s_flush_pending) return false;
+  FILE *fp = fopen(fn, "ab");
+  if (fp == NULL) return false;
+  bool ok = (s_file_size > 0 ||
+             fwrite(NAMES_FILE_MAGIC, NAMES_FILE_MAGIC_LEN, 1, fp) == 1);
+  ok = ok && hub_names_write_record(fp, s_pool.Get(id));
+  s_file_size = ftell(fp);
+  return (fclose(fp) == 0 && ok);
+}
+
+uint16_t hub_name_intern(const char *name, size_t len) {
+  if (len == 0) return HUB_NAME_NONE;
+  if (len > NAMES_MAX_LEN) len = NAMES_MAX_LEN;
+  if (memchr(name, '\0', len) != nullptr) len = strlen(name);
+  uint16_t id = s_pool.Find(name, len);
+  if (id != HUB_NAME_NONE) return id;
+  id = hub_names_add(name, len);
+  if (id == HUB_NAME_NONE) {
+    if (s_stats.full++ == 0) {
+      LOG(LL_ERROR, ("Name pool is full (%d names, %d bytes)",
+                     (int) s_pool.size() - 1, (int) s_pool.mem_used()));
+    }
+    return HUB_NAME_NONE;
+  }
+  s_stats.added++;
+  if (!hub_names_append(id)) {
+    // Rewrite the whole file on the next flush.
+    s_flush_pending = true;
+  }
+  return id;
+}
+
+const char *hub_name_get(uint16_t id) {
+  return s_pool.Get(id);
+}
+
+void hub_names_flush(void) {
+  const char *fn = mgos_sys_config_get_hub_names_file();
+  if (!s_flush_pending || fn == NULL) return;
+  std::string tmp_fn = mgos::SPrintf("%s.tmp", fn);
+  FILE *fp = fopen(tmp_fn.c_str(), "wb");
+  if (fp == NULL) return;
+  bool ok = (fwrite(NAMES_FILE_MAGIC, NAMES_FILE_MAGIC_LEN, 1, fp) == 1);
+  for (size_t id = 1; id < s_pool.size() && ok; id++) {
+    ok = hub_names_write_record(fp, s_pool.Get(id));
+  }
+  long size = ftell(fp);
+  ok = (fclose(fp) == 0 && ok);
+  if (!ok || rename(tmp_fn.c_str(), fn) != 0) {
+    LOG(LL_ERROR, ("Failed to write %s", fn));
+    remove(tmp_fn.c_str());
+    return;
+  }
+  s_file_size = size;
+  s_flush_pending = false;
+  LOG(LL_INFO, ("Saved %d names to %s", (int) s_pool.size() - 1, fn));
+}
+
+static void hub_names_load(void) {
+  const char *fn = mgos_sys_config_get_hub_names_file();
+  if (fn == NULL) return;
+  FILE *fp = fopen(fn, "rb");
+  if (fp == NULL) return;
+  char buf[NAMES_MAX_LEN + 1];
+  if (fread(buf, NAMES_FILE_MAGIC_LEN, 1, fp) != 1 ||
+      memcmp(buf, NAMES_FILE_MAGIC, NAMES_FILE_MAGIC_LEN) != 0) {
+    LOG(LL_ERROR, ("%s: invalid file", fn));
+    fclose(fp);
+    s_flush_pending = true;
+    return;
+  }
+  uint8_t len;
+  while (fread(&len, 1, 1, fp) == 1) {
+    if (len > 0 && fread(buf, len, 1, fp) != 1) {
+      // Partially written record, will be dropped by the rewrite.
+      s_flush_pending = true;
+      break;
+    }
+    // IDs are positional, so every record gets one, even if empty.
+    if (hub_names_add(buf, len) == HUB_NAME_NONE) {
+      LOG(LL_ERROR, ("%s: too many names", fn));
+      s_flush_pending = true;
+      break;
+    }
+  }
+  s_file_size = ftell(fp);
+  fclose(fp);
+  LOG(LL_INFO, ("Loaded %d names from %s", (int) s_pool.size() - 1, fn));
+}
+
+static void hub_data_names_status_handler(
+    struct mg_rpc_request_info *ri, void *cb_arg UNUSED_ARG,
+    struct mg_rpc_frame_info *fi UNUSED_ARG, struct mg_str args UNUSED_ARG) {
+  mg_rpc_send_responsef(ri, "{names: %d, mem_used: %d, added: %u, full: %u}",
+                        (int) s_pool.size() - 1, (int) s_pool.mem_used(),
+                        s_stats.added, s_stats.full);
+}
+
+bool hub_names_init(void) {
+  hub_names_load();
+  hub_names_flush();
+  mg_rpc_add_handler(mgos_rpc_get_global(), "Hub.Data.NamesStatus", "",
+                     hub_data_names_status_handler, NULL);
+  return true;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Sensor name pool. Each distinct name is stored once and referred to by
+// a 16-bit ID. IDs never change and are persisted along with the names,
+// so data records only need to store the ID.
+
+#define HUB_NAME_NONE 0
+
+// Returns the ID of the name, adding it to the pool if necessary.
+// Returns HUB_NAME_NONE for an empty name or if the pool is full.
+uint16_t hub_name_intern(const char *name, size_t len);
+
+// Returns the name with the specified ID, "" for HUB_NAME_NONE.
+const char *hub_name_get(uint16_t id);
+
+// Writes out the names if an earlier append failed.
+void hub_names_flush(void);
+
+bool hub_names_init(void);
@@ -0,0 +1,208 @@
+#include "hub_ratelimit.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <string>
+
+#include "mgos.hpp"
+#include "mgos_rpc.h"
+
+#include "hub_data.hpp"
+#include "hub_stats.hpp"
+#include "hub_timer_wheel.hpp"
+
+#define FLUSH_WHEEL_SLOTS 64
+#define MAX_SOURCES 16
+// Points older than this many seconds are backlog, not live data.
+#define LIVE_MAX_AGE 60
+
+enum coalesce_mode {
+  COALESCE_DROP,
+  COALESCE_LATEST,
+  COALESCE_AVG,
+};
+
+class TokenBucket {
+ public:
+  // rate is tokens per minute.
+  bool Take(int rate, int burst, double now);
+  // Seconds until a token is available, as of the last Take().
+  double GetWait(int rate) const;
+  double uts() const;
+
+ private:
+  double tokens_ = 0;
+  double uts_ = 0;  // Last refill.
+};
+
+struct SensorLimit {
+  TokenBucket bucket;
+  // Points merged since the last one added. Pending one is the latest,
+  // for COALESCE_AVG its value is replaced with the average when added.
+  struct SensorData pending;
+  double sum = 0;
+  int count = 0;
+  unsigned int throttled = 0;
+};
+
+struct SourceLimit {
+  TokenBucket bucket;
+  unsigned int rejected = 0;
+};
+
+static void hub_ratelimit_flush_cb(uint64_t key);
+
+static std::map<uint64_t, SensorLimit> s_sensors;
+static std::map<std::string, SourceLimit> s_sources;
+static TimerWheel s_flush_wheel(FLUSH_WHEEL_SLOTS, hub_ratelimit_flush_cb);
+
+bool TokenBucket::Take(int rate, int burst, double now) {
+  if (uts_ == 0) {
+    tokens_ = burst;
+  } else {
+    tokens_ = std::min<double>(burst, tokens_ + (now - uts_) * rate / 60.0);
+  }
+  uts_ = now;
+  if (tokens_ < 1) return false;
+  tokens_ -= 1;
+  return true;
+}
+
+double TokenBucket::GetWait(int rate) const {
+  return (tokens_ < 1 ? (1 - tokens_) * 60.0 / rate : 0);
+}
+
+double TokenBucket::uts() const {
+  return uts_;
+}
+
+static enum coalesce_mode get_coalesce_mode(void) {
+  const char *mode = mgos_sys_config_get_hub_ratelimit_coalesce();
+  if (mode == nullptr) return COALESCE_DROP;
+  if (strcmp(mode, "latest") == 0) return COALESCE_LATEST;
+  if (strcmp(mode, "avg") == 0) return COALESCE_AVG;
+  return COALESCE_DROP;
+}
+
+// Least recently used source goes when the table is full.
+static SourceLimit *get_source(const struct mg_str *src) {
+  std::string name(src->p, src->len);
+  auto it = s_sources.find(name);
+  if (it != s_sources.end()) return &it->second;
+  if (s_sources.size() >= MAX_SOURCES) {
+    auto lru = s_sources.begin();
+    for (auto i = s_sources.begin(); i != s_sources.end(); i++) {
+      if (i->second.bucket.uts() < lru->second.bucket.uts()) lru = i;
+    }
+    s_sources.erase(lru);
+  }
+  return &s_sources[name];
+}
+
+bool hub_ratelimit_admit(const struct mg_str *src) {
+  const int rate = mgos_sys_config_get_hub_ratelimit_source_rate();
+  if (rate <= 0) return true;
+  SourceLimit *sl = get_source(src);
+  if (sl->bucket.Take(rate, mgos_sys_config_get_hub_ratelimit_source_burst(),
+                      mgos_uptime())) {
+    return true;
+  }
+  if (sl->rejected++ == 0) {
+    LOG(LL_WARN, ("%.*s: too many requests", (int) src->len, src->p));
+  }
+  HUB_COUNTER_INC(rx_rejected);
+  return false;
+}
+
+bool hub_ratelimit_check(const struct SensorData *sd) {
+  const int rate = mgos_sys_config_get_hub_ratelimit_sensor_rate();
+  if (rate <= 0) return true;
+  // Backlog flushed by a relay is not live data, let it into history.
+  // Requests carrying it are still subject to the source limit.
+  if (sd->ts < mg_time() - LIVE_MAX_AGE) return true;
+  const struct SensorData *last = hub_get_data(sd->sid, sd->subid);
+  if (last != nullptr && sd->ts < last->ts) return true;
+  SensorLimit &sl = s_sensors[sd->GetKey()];
+  // Pending point goes first, so there is no point in taking a token.
+  if (sl.count == 0 &&
+      sl.bucket.Take(rate, mgos_sys_config_get_hub_ratelimit_sensor_burst(),
+                     mgos_uptime())) {
+    return true;
+  }
+  const enum coalesce_mode mode = get_coalesce_mode();
+  if (sl.throttled++ == 0) {
+    LOG(LL_WARN, ("%d/%d: over %d points/min, %s", sd->sid, sd->subid, rate,
+                  (mode == COALESCE_DROP ? "dropping" : "coalescing")));
+  }
+  if (mode == COALESCE_DROP) {
+    HUB_COUNTER_INC(rx_throttled);
+    return false;
+  }
+  HUB_COUNTER_INC(rx_coalesced);
+  if (sl.count == 0) {
+    s_flush_wheel.Schedule(sd->GetKey(),
+                           mg_time() + sl.bucket.GetWait(rate));
+    sl.sum = 0;
+  }
+  sl.pending = *sd;
+  sl.sum += sd->value;
+  sl.count++;
+  if (mode == COALESCE_AVG) sl.pending.value = sl.sum / sl.count;
+  return false;
+}
+
+static void hub_ratelimit_flush_cb(uint64_t key) {
+  auto it = s_sensors.find(key);
+  if (it == s_sensors.end() || it->second.count == 0) return;
+  SensorLimit &sl = it->second;
+  const int rate = mgos_sys_config_get_hub_ratelimit_sensor_rate();
+  if (rate > 0 &&
+      !sl.bucket.Take(rate, mgos_sys_config_get_hub_ratelimit_sensor_burst(),
+                      mgos_uptime())) {
+    s_flush_wheel.Schedule(key, mg_time() + sl.bucket.GetWait(rate));
+    return;
+  }
+  // Handlers may add data, which can move entries, so add a copy.
+  struct SensorData sd = sl.pending;
+  sl.count = 0;
+  hub_stats_rx_begin(sd.ts);
+  hub_add_data(&sd);
+  hub_stats_rx_end();
+}
+
+static void hub_data_ratelimit_handler(struct mg_rpc_request_info *ri,
+                                       void *cb_arg UNUSED_ARG,
+                                       struct mg_rpc_frame_info *fi UNUSED_ARG,
+                                       struct mg_str args UNUSED_ARG) {
+  struct mbuf mb;
+  mbuf_init(&mb, 50);
+  struct json_out out = JSON_OUT_MBUF(&mb);
+  json_printf(&out, "{sensors: [");
+  bool first = true;
+  for (const auto &it : s_sensors) {
+    const SensorLimit &sl = it.second;
+    if (sl.throttled == 0) continue;
+    json_printf(&out, "%s{sid: %d, subid: %d, throttled: %u, pending: %d}",
+                (first ? "" : ", "), (int) (it.first >> 32),
+                (int) (it.first & 0xffffffff), sl.throttled, sl.count);
+    first = false;
+  }
+  json_printf(&out, "], sources: [");
+  first = true;
+  for (const auto &it : s_sources) {
+    if (it.second.rejected == 0) continue;
+    json_printf(&out, "%s{src: %Q, rejected: %u}", (first ? "" : ", "),
+                it.first.c_str(), it.second.rejected);
+    first = false;
+  }
+  json_printf(&out, "]}");
+  mg_rpc_send_responsef(ri, "%.*s", (int) mb.len, mb.buf);
+  mbuf_free(&mb);
+}
+
+bool hub_ratelimit_init(void) {
+  mg_rpc_add_handler(mgos_rpc_get_global(), "Hub.Data.RateLimit", "",
+                     hub_data_ratelimit_handler, NULL);
+  return true;
+}
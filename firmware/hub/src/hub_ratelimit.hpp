@@ -0,0 +1,23 @@
+#pragma once
+
+struct SensorData;
+struct mg_str;
+
+// Token bucket rate limiting of data ingest, so that a misbehaving sensor
+// or relay cannot flood the hub. See hub.ratelimit.
+
+// Admission of a data request from src, charged one token per request.
+// Checked before the request is parsed.
+// Returns false if the request should be rejected.
+bool hub_ratelimit_admit(const struct mg_str *src);
+
+// Per-sensor limit, charged one token per live point. Backlog, i.e. points
+// older than a minute or than the sensor's latest one, is not limited.
+// Age is judged by the point's timestamp, so a sensor whose clock lags by
+// more than a minute is not limited either, only its source is.
+// Returns true if the point should be added now. Otherwise it has been
+// dropped or, depending on hub.ratelimit.coalesce, merged into a pending
+// point that is added when the sensor's bucket has a token again.
+bool hub_ratelimit_check(const struct SensorData *sd);
+
+bool hub_ratelimit_init(void);
@@ -0,0 +1,282 @@
+#include "hub_report.hpp"
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+#include "mgos.hpp"
+#include "mgos_rpc.h"
+
+#include "hub_data.hpp"
+#include "hub_spool.hpp"
+#include "hub_stats.hpp"
+
+// Number of unanswered batches remembered in case a response arrives late.
+#define MAX_UNACKED 8
+
+struct ReportBatch {
+  int id;
+  bool replay;
+  double sent_uts;
+  std::vector<ReportPoint> points;
+};
+
+// A batch that was given up on. Live data has been spooled, if the server
+// responds after all, the spooled copy is cancelled so it is not sent twice.
+struct UnackedBatch {
+  int id;
+  bool replay;
+  uint64_t spool_first;
+  size_t spool_len;
+};
+
+struct ReportStats {
+  unsigned int calls = 0;
+  unsigned int sent = 0;
+  unsigned int failed = 0;
+  unsigned int dropped = 0;
+};
+
+static std::deque<ReportPoint> s_queue;
+static std::vector<ReportBatch> s_in_flight;
+static std::deque<UnackedBatch> s_unacked;
+static ReportStats s_stats;
+static int s_next_batch_id = 1;
+static bool s_flush_pending = false;
+// Whether the server is reachable, i.e. the last call got a response.
+static bool s_server_ok = false;
+static mgos_timer_id s_timer_id = MGOS_INVALID_TIMER_ID;
+static mgos_timer_id s_replay_timer_id = MGOS_INVALID_TIMER_ID;
+
+static void hub_report_flush(bool force);
+
+static void hub_report_timer_cb(void *arg UNUSED_ARG);
+
+static void hub_report_replay_timer_cb(void *arg UNUSED_ARG);
+
+static void hub_report_arm_timer(void) {
+  if (s_timer_id != MGOS_INVALID_TIMER_ID) return;
+  if (s_queue.empty() && s_in_flight.empty()) return;
+  s_timer_id = mgos_set_timer(mgos_sys_config_get_hub_report_batch_delay_ms(),
+                              0, hub_report_timer_cb, NULL);
+}
+
+static void hub_report_arm_replay_timer(void) {
+  if (s_replay_timer_id != MGOS_INVALID_TIMER_ID) return;
+  if (!s_server_ok || hub_spool_is_empty()) return;
+  s_replay_timer_id =
+      mgos_set_timer(mgos_sys_config_get_hub_spool_replay_interval_ms(), 0,
+                     hub_report_replay_timer_cb, NULL);
+}
+
+static void hub_report_unacked(const ReportBatch &b) {
+  UnackedBatch u = {b.id, b.replay, 0, 0};
+  if (!b.replay) u.spool_len = hub_spool_write(b.points, &u.spool_first);
+  if (s_unacked.size() >= MAX_UNACKED) s_unacked.pop_front();
+  s_unacked.push_back(u);
+}
+
+// ok: the server has accepted the data.
+// reachable: the server has responded at all. If it has not, live data is
+// spooled for later replay.
+static std::vector<ReportBatch>::iterator hub_report_batch_done(
+    std::vector<ReportBatch>::iterator it, bool ok, bool reachable) {
+  if (ok) {
+    s_stats.sent += it->points.size();
+    HUB_COUNTER_ADD(report_sent, it->points.size());
+  } else {
+    s_stats.failed += it->points.size();
+    HUB_COUNTER_ADD(report_failed, it->points.size());
+  }
+  if (!reachable) {
+    hub_report_unacked(*it);
+  } else if (it->replay) {
+    // If the server rejected the data, there's no point in retrying it.
+    hub_spool_commit();
+  }
+  s_server_ok = reachable;
+  it = s_in_flight.erase(it);
+  hub_report_arm_replay_timer();
+  return it;
+}
+
+// Response to a batch that has timed out. Same as for an in-flight one,
+// even if the server rejected the data it should not be retried.
+static void hub_report_late_result(int id) {
+  for (auto it = s_unacked.begin(); it != s_unacked.end(); it++) {
+    if (it->id != id) continue;
+    LOG(LL_INFO, ("Batch %d: late response", id));
+    if (!it->replay) {
+      hub_spool_cancel(it->spool_first, it->spool_len);
+    } else if (std::none_of(
+                   s_in_flight.begin(), s_in_flight.end(),
+                   [](const ReportBatch &b) { return b.replay; })) {
+      // Nothing has been read from the spool since, so this commits it.
+      hub_spool_commit();
+    }
+    s_unacked.erase(it);
+    s_server_ok = true;
+    hub_report_arm_replay_timer();
+    break;
+  }
+}
+
+static void hub_report_result_cb(struct mg_rpc *c UNUSED_ARG, void *cb_arg,
+                                 struct mg_rpc_frame_info *fi UNUSED_ARG,
+                                 struct mg_str result UNUSED_ARG,
+                                 int error_code, struct mg_str error_msg) {
+  int id = (intptr_t) cb_arg;
+  auto it = std::find_if(s_in_flight.begin(), s_in_flight.end(),
+                         [id](const ReportBatch &b) { return b.id == id; });
+  if (it != s_in_flight.end()) {
+    if (error_code != 0) {
+      LOG(LL_ERROR, ("Batch %d (%d points) failed: %d %.*s", id,
+                     (int) it->points.size(), error_code,
+                     (int) error_msg.len, error_msg.p));
+    }
+    hub_report_batch_done(it, (error_code == 0), true /* reachable */);
+  } else {
+    hub_report_late_result(id);
+  }
+  // A slot has been freed, send what's been waiting for it.
+  hub_report_flush(s_flush_pending);
+}
+
+static void hub_report_expire_in_flight(void) {
+  double now = mgos_uptime();
+  int timeout = mgos_sys_config_get_hub_report_timeout();
+  for (auto it = s_in_flight.begin(); it != s_in_flight.end();) {
+    if (now - it->sent_uts < timeout) {
+      it++;
+      continue;
+    }
+    LOG(LL_ERROR, ("Batch %d (%d points) timed out", it->id,
+                   (int) it->points.size()));
+    it = hub_report_batch_done(it, false /* ok */, false /* reachable */);
+  }
+}
+
+static bool hub_report_send_batch(std::vector<ReportPoint> points,
+                                  bool replay) {
+  const char *addr = mgos_sys_config_get_hub_data_server_addr();
+  ReportBatch b;
+  b.id = s_next_batch_id++;
+  b.replay = replay;
+  b.sent_uts = mgos_uptime();
+  b.points = std::move(points);
+  struct mbuf mb;
+  mbuf_init(&mb, 50);
+  struct json_out out = JSON_OUT_MBUF(&mb);
+  for (const ReportPoint &p : b.points) {
+    if (mb.len > 0) json_printf(&out, ", ");
+    json_printf(&out, "{sid: %d, subid: %d, ts: %.3lf, v: %lf}", p.sid,
+                p.subid, p.ts, p.value);
+  }
+  struct mg_rpc_call_opts opts = {};
+  opts.dst = mg_mk_str(addr);
+  // We do our own queueing, fail immediately if the server is not reachable.
+  opts.no_queue = true;
+  bool res = mg_rpc_callf(mgos_rpc_get_global(), mg_mk_str("Sensor.DataMulti"),
+                          hub_report_result_cb, (void *) (intptr_t) b.id,
+                          &opts, "{data: [%.*s]}", (int) mb.len, mb.buf);
+  mbuf_free(&mb);
+  s_stats.calls++;
+  int id = b.id;
+  s_in_flight.push_back(std::move(b));
+  if (!res) {
+    LOG(LL_DEBUG, ("Failed to send batch %d", id));
+    hub_report_batch_done(s_in_flight.end() - 1, false /* ok */,
+                          false /* reachable */);
+  }
+  return res;
+}
+
+static void hub_report_flush(bool force) {
+  const int batch_size = mgos_sys_config_get_hub_report_batch_size();
+  const int max_in_flight = mgos_sys_config_get_hub_report_max_in_flight();
+  hub_report_expire_in_flight();
+  while (!s_queue.empty()) {
+    // Partial batches are only sent when the wait time has expired.
+    if ((int) s_queue.size() < batch_size && !force) break;
+    if ((int) s_in_flight.size() >= max_in_flight) {
+      s_flush_pending = true;
+      break;
+    }
+    std::vector<ReportPoint> points;
+    while (!s_queue.empty() && (int) points.size() < batch_size) {
+      points.push_back(s_queue.front());
+      s_queue.pop_front();
+    }
+    if (!hub_report_send_batch(std::move(points), false /* replay */)) break;
+  }
+  if (s_queue.empty()) s_flush_pending = false;
+  hub_report_arm_timer();
+}
+
+static void hub_report_timer_cb(void *arg UNUSED_ARG) {
+  s_timer_id = MGOS_INVALID_TIMER_ID;
+  hub_report_flush(true /* force */);
+}
+
+// Spooled data is replayed one batch at a time, with a delay in between,
+// once the server is reachable again.
+static void hub_report_replay_timer_cb(void *arg UNUSED_ARG) {
+  s_replay_timer_id = MGOS_INVALID_TIMER_ID;
+  if (!s_server_ok) return;
+  for (const ReportBatch &b : s_in_flight) {
+    if (b.replay) return;  // Will be re-armed when done.
+  }
+  const int max_in_flight = mgos_sys_config_get_hub_report_max_in_flight();
+  if ((int) s_in_flight.size() >= max_in_flight) {
+    hub_report_arm_replay_timer();
+    return;
+  }
+  std::vector<ReportPoint> points;
+  if (!hub_spool_read(mgos_sys_config_get_hub_report_batch_size(), &points)) {
+    return;
+  }
+  LOG(LL_DEBUG, ("Replaying %d points", (int) points.size()));
+  hub_report_send_batch(std::move(points), true /* replay */);
+  hub_report_arm_timer();
+}
+
+void hub_report_add(const struct SensorData *sd) {
+  if (sd->sid < 0) return;
+  if (mgos_sys_config_get_hub_data_server_addr() == NULL) return;
+  if ((int) s_queue.size() >= mgos_sys_config_get_hub_report_queue_len()) {
+    if (s_stats.dropped % 100 == 0) {
+      LOG(LL_ERROR, ("Report queue overflow, %u dropped", s_stats.dropped));
+    }
+    s_queue.pop_front();
+    s_stats.dropped++;
+  }
+  s_queue.push_back({sd->sid, sd->subid, sd->ts, sd->value});
+  if ((int) s_queue.size() >= mgos_sys_config_get_hub_report_batch_size()) {
+    hub_report_flush(false /* force */);
+  } else {
+    hub_report_arm_timer();
+  }
+}
+
+static void hub_report_status_handler(struct mg_rpc_request_info *ri,
+                                      void *cb_arg UNUSED_ARG,
+                                      struct mg_rpc_frame_info *fi UNUSED_ARG,
+                                      struct mg_str args UNUSED_ARG) {
+  int in_flight_points = 0;
+  for (const ReportBatch &b : s_in_flight) {
+    in_flight_points += b.points.size();
+  }
+  mg_rpc_send_responsef(ri,
+                        "{queued: %d, in_flight: %d, in_flight_points: %d, "
+                        "calls: %u, sent: %u, failed: %u, dropped: %u}",
+                        (int) s_queue.size(), (int) s_in_flight.size(),
+                        in_flight_points, s_stats.calls, s_stats.sent,
+                        s_stats.failed, s_stats.dropped);
+}
+
+bool hub_report_init(void) {
+  struct mg_rpc *c = mgos_rpc_get_global();
+  mg_rpc_add_handler(c, "Hub.Report.Status", "", hub_report_status_handler,
+                     NULL);
+  return true;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstdint>
+
+struct SensorData;
+
+struct ReportPoint {
+  int32_t sid;
+  int32_t subid;
+  double ts;
+  double value;
+};
+
+// Queues a data point for reporting to the data server.
+// Points are sent in batches using Sensor.DataMulti.
+void hub_report_add(const struct SensorData *sd);
+
+bool hub_report_init(void);
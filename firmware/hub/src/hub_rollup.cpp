@@ -0,0 +1,229 @@
+#include "hub_rollup.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <map>
+
+#include "mgos.hpp"
+#include "mgos_rpc.h"
+
+#include "hub_data.hpp"
+
+// Bucket width and number of buckets for each resolution:
+// 1 hour of 1 minute, 1 day of 15 minute and 1 week of 1 hour aggregates.
+static const struct {
+  int width;
+  int len;
+} s_resolutions[] = {
+    {60, 60},
+    {900, 96},
+    {3600, 168},
+};
+
+#define NUM_RESOLUTIONS (sizeof(s_resolutions) / sizeof(s_resolutions[0]))
+
+// Values are kept as float to save memory, the sum is double so that it
+// does not lose precision over thousands of points.
+struct RollupBucket {
+  double sum;
+  float min;
+  float max;
+  float last;
+  uint16_t count;
+};
+
+// Ring of buckets indexed directly by bucket number, so that each point is
+// O(1) to add, even if it arrives out of order.
+class RollupRing {
+ public:
+  RollupRing(int width, int len);
+
+  int width() const;
+  size_t GetMemoryUsage() const;
+  // Start of the oldest bucket that can be stored.
+  double GetOldestTS() const;
+  bool Add(double ts, double value);
+  void Get(double from, double to, int limit,
+           std::vector<RollupPoint> *points) const;
+
+ private:
+  const int width_;
+  int64_t latest_ = -1;  // Number of the newest bucket.
+  std::vector<RollupBucket> buckets_;
+};
+
+struct RollupStats {
+  unsigned int added = 0;
+  unsigned int dropped = 0;
+  unsigned int too_old = 0;
+};
+
+static std::map<uint64_t, std::vector<RollupRing>> s_rollups;
+static size_t s_mem_used = 0;
+static RollupStats s_stats;
+
+RollupRing::RollupRing(int width, int len) : width_(width), buckets_(len) {
+}
+
+int RollupRing::width() const {
+  return width_;
+}
+
+size_t RollupRing::GetMemoryUsage() const {
+  return sizeof(*this) + buckets_.size() * sizeof(RollupBucket);
+}
+
+double RollupRing::GetOldestTS() const {
+  const int64_t len = buckets_.size();
+  return (double) (latest_ - len + 1) * width_;
+}
+
+bool RollupRing::Add(double ts, double value) {
+  const int64_t len = buckets_.size();
+  const int64_t b = std::floor(ts / width_);
+  if (latest_ < 0) latest_ = b;
+  if (b <= latest_ - len) return false;
+  // Clear buckets skipped since the last update.
+  for (int64_t i = std::max(latest_ + 1, b - len + 1); i <= b; i++) {
+    buckets_[i % len].count = 0;
+  }
+  latest_ = std::max(latest_, b);
+  RollupBucket &rb = buckets_[b % len];
+  if (rb.count == 0) {
+    rb.min = rb.max = rb.sum = value;
+  } else {
+    rb.min = std::min<float>(rb.min, value);
+    rb.max = std::max<float>(rb.max, value);
+    rb.sum += value;
+  }
+  rb.last = value;
+  if (rb.count < UINT16_MAX) rb.count++;
+  return true;
+}
+
+void RollupRing::Get(double from, double to, int limit,
+                     std::vector<RollupPoint> *points) const {
+  const int64_t len = buckets_.size();
+  if (latest_ < 0) return;
+  int64_t b = std::max<int64_t>(latest_ - len + 1, std::ceil(from / width_));
+  for (; b <= latest_ && (int) points->size() < limit; b++) {
+    double bts = (double) b * width_;
+    if (bts >= to) break;
+    const RollupBucket &rb = buckets_[b % len];
+    if (rb.count == 0) continue;
+    points->push_back({bts, rb.count, rb.min, rb.max, rb.sum, rb.last});
+  }
+}
+
+void hub_rollup_add(const struct SensorData *sd) {
+  if (!mgos_sys_config_get_hub_rollup_enable()) return;
+  // Limit and output states are reported as data too. Budget is only
+  // enough for a handful of sensors, keep it for the real ones.
+  if (sd->sid == mgos_sys_config_get_hub_lim_sid() ||
+      sd->sid == mgos_sys_config_get_hub_out_sid()) {
+    return;
+  }
+  auto it = s_rollups.find(sd->GetKey());
+  if (it == s_rollups.end()) {
+    const size_t max_size = mgos_sys_config_get_hub_rollup_max_size();
+    size_t size = 0;
+    for (const auto &r : s_resolutions) {
+      size += sizeof(RollupRing) + r.len * sizeof(RollupBucket);
+    }
+    if (s_mem_used + size > max_size) {
+      s_stats.dropped++;
+      return;
+    }
+    std::vector<RollupRing> rings;
+    for (const auto &r : s_resolutions) {
+      rings.emplace_back(r.width, r.len);
+      s_mem_used += rings.back().GetMemoryUsage();
+    }
+    it = s_rollups.emplace(sd->GetKey(), std::move(rings)).first;
+  }
+  bool added = false;
+  for (RollupRing &rr : it->second) {
+    added |= rr.Add(sd->ts, sd->value);
+  }
+  if (added) {
+    s_stats.added++;
+  } else {
+    s_stats.too_old++;
+  }
+}
+
+bool hub_rollup_get(int sid, int subid, int *width, double from, double to,
+                    int limit, std::vector<RollupPoint> *points) {
+  const auto it = s_rollups.find(SensorData::MakeKey(sid, subid));
+  if (it == s_rollups.end()) return false;
+  const RollupRing *rr = nullptr;
+  if (*width == 0) {
+    // Finest resolution that covers the range and fits within the limit.
+    double range = std::min(to, mg_time()) - from;
+    for (const RollupRing &r : it->second) {
+      rr = &r;
+      if (r.GetOldestTS() <= from && range / r.width() <= limit) break;
+    }
+  } else {
+    for (const RollupRing &r : it->second) {
+      if (r.width() == *width) rr = &r;
+    }
+  }
+  if (rr == nullptr) return false;
+  *width = rr->width();
+  rr->Get(from, to, limit, points);
+  return true;
+}
+
+static void hub_data_aggregate_handler(struct mg_rpc_request_info *ri,
+                                       void *cb_arg UNUSED_ARG,
+                                       struct mg_rpc_frame_info *fi UNUSED_ARG,
+                                       struct mg_str args) {
+  int sid = -1, subid = 0, width = 0, limit = 500;
+  double from = 0, to = INFINITY;
+  json_scanf(args.p, args.len, ri->args_fmt, &sid, &subid, &width, &from, &to,
+             &limit);
+
+  std::vector<RollupPoint> points;
+  if (!hub_rollup_get(sid, subid, &width, from, to, limit, &points)) {
+    mg_rpc_send_errorf(ri, 404, "no aggregates for %d/%d res %d", sid, subid,
+                       width);
+    return;
+  }
+
+  struct mbuf mb;
+  mbuf_init(&mb, 50);
+  struct json_out out = JSON_OUT_MBUF(&mb);
+  for (const RollupPoint &p : points) {
+    if (mb.len > 0) json_printf(&out, ", ");
+    json_printf(&out,
+                "{ts: %.0lf, n: %d, min: %.3lf, max: %.3lf, avg: %.3lf, "
+                "last: %.3lf}",
+                p.ts, p.count, p.min, p.max, p.sum / p.count, p.last);
+  }
+  mg_rpc_send_responsef(ri, "{sid: %d, subid: %d, res: %d, data: [%.*s]}",
+                        sid, subid, width, (int) mb.len, mb.buf);
+  mbuf_free(&mb);
+}
+
+static void hub_data_aggregate_status_handler(
+    struct mg_rpc_request_info *ri, void *cb_arg UNUSED_ARG,
+    struct mg_rpc_frame_info *fi UNUSED_ARG, struct mg_str args UNUSED_ARG) {
+  mg_rpc_send_responsef(ri,
+                        "{sensors: %d, mem_used: %d, added: %u, dropped: %u, "
+                        "too_old: %u}",
+                        (int) s_rollups.size(), (int) s_mem_used,
+                        s_stats.added, s_stats.dropped, s_stats.too_old);
+}
+
+bool hub_rollup_init(void) {
+  struct mg_rpc *c = mgos_rpc_get_global();
+  mg_rpc_add_handler(
+      c, "Hub.Data.Aggregate",
+      "{sid: %d, subid: %d, res: %d, from: %lf, to: %lf, limit: %d}",
+      hub_data_aggregate_handler, NULL);
+  mg_rpc_add_handler(c, "Hub.Data.AggregateStatus", "",
+                     hub_data_aggregate_status_handler, NULL);
+  return true;
+}
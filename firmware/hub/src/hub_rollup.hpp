@@ -0,0 +1,24 @@
+#pragma once
+
+#include <vector>
+
+struct SensorData;
+
+struct RollupPoint {
+  double ts;  // Start of the bucket.
+  int count;
+  double min;
+  double max;
+  double sum;
+  double last;
+};
+
+void hub_rollup_add(const struct SensorData *sd);
+
+// Returns up to limit aggregates of the specified width (in seconds)
+// for buckets that start at from <= ts < to, oldest first.
+// If width is 0, the finest resolution that covers the range is used.
+bool hub_rollup_get(int sid, int subid, int *width, double from, double to,
+                    int limit, std::vector<RollupPoint> *points);
+
+bool hub_rollup_init(void);
@@ -0,0 +1,26 @@
+#include "hub_sensor_data.hpp"
+
+#include <cstdio>
+
+SensorData::SensorData(int _sid, int _subid, double _ts, double _value)
+    : sid(_sid), subid(_subid), ts(_ts), value(_value) {
+}
+
+const char *SensorData::GetName() const {
+  return hub_name_get(name_id);
+}
+
+uint64_t SensorData::GetKey() const {
+  return MakeKey(sid, subid);
+}
+
+uint64_t SensorData::MakeKey(int sid, int subid) {
+  return ((static_cast<uint64_t>(sid) << 32) | subid);
+}
+
+std::string SensorData::ToString() const {
+  char buf[320];
+  snprintf(buf, sizeof(buf), "%d/%d (%s) %.3lf @ %.3lf", sid, subid, GetName(),
+           value, ts);
+  return buf;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "hub_names.hpp"
+
+// A data point. The data table stores the latest one of each sensor.
+struct SensorData {
+  int sid = -1;
+  int subid = -1;
+  double ts = 0.0;
+  double value = 0.0;
+  uint16_t name_id = HUB_NAME_NONE;
+  // Change sequence number of the entry in the data table, see Hub.Data.List.
+  uint32_t seq = 0;
+
+  SensorData() = default;
+  SensorData(int sid, int subid, double ts, double value);
+  const char *GetName() const;
+  uint64_t GetKey() const;
+  static uint64_t MakeKey(int sid, int subid);
+  std::string ToString() const;
+};
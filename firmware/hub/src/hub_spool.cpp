@@ -0,0 +1,283 @@
+#include "hub_spool.hpp"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <deque>
+#include <string>
+
+#include "mgos.hpp"
+#include "mgos_rpc.h"
+
+// The spool is a sequence of append-only segment files, <prefix>.<seq>.
+// Oldest segment is read from, newest is appended to.
+// When total size exceeds the limit, oldest segments are removed.
+#define SPOOL_NUM_SEGMENTS 8
+
+// Records are fixed size, a partially written record at the end of a segment
+// (e.g. due to power loss) is ignored. Cancelled records are overwritten
+// with an invalid sid and skipped on replay.
+static_assert(sizeof(ReportPoint) == 24, "ReportPoint must be 24 bytes");
+
+struct SpoolSegment {
+  unsigned int seq;
+  size_t size;
+  uint64_t first;  // Index of the first record.
+};
+
+struct SpoolStats {
+  unsigned int written = 0;
+  unsigned int replayed = 0;
+  unsigned int evicted = 0;
+  unsigned int cancelled = 0;
+  unsigned int errors = 0;
+};
+
+static std::deque<SpoolSegment> s_segs;
+static unsigned int s_next_seq = 0;
+// Index of the next record written. Not persisted, only needs to be stable
+// while the process is running.
+static uint64_t s_next_rec = 0;
+// Whether the last segment can be appended to. Existing segments are never
+// appended to after reboot, we always start a new one.
+static bool s_append = false;
+// Read position in the first segment. Not persisted, so after reboot
+// the first segment will be replayed from the start.
+static size_t s_read_offset = 0;
+// Position of the last read, to validate the commit.
+static unsigned int s_read_seq = 0;
+static size_t s_read_pos = 0;
+// Records consumed and points returned by the last read.
+static size_t s_read_len = 0;
+static size_t s_read_points = 0;
+static size_t s_total_size = 0;
+static SpoolStats s_stats;
+
+static std::string hub_spool_seg_name(unsigned int seq) {
+  return mgos::SPrintf("%s.%u", mgos_sys_config_get_hub_spool_file_prefix(),
+                       seq);
+}
+
+static size_t hub_spool_seg_size(void) {
+  size_t seg_size =
+      mgos_sys_config_get_hub_spool_max_size() / SPOOL_NUM_SEGMENTS;
+  seg_size -= seg_size % sizeof(ReportPoint);
+  return std::max(seg_size, sizeof(ReportPoint));
+}
+
+static size_t hub_spool_num_records(void) {
+  return (s_total_size - s_read_offset) / sizeof(ReportPoint);
+}
+
+static void hub_spool_remove_first(void) {
+  const SpoolSegment &seg = s_segs.front();
+  remove(hub_spool_seg_name(seg.seq).c_str());
+  s_total_size -= seg.size;
+  s_read_offset = 0;
+  s_segs.pop_front();
+  if (s_segs.empty()) s_append = false;
+}
+
+static void hub_spool_evict(void) {
+  const size_t max_size = mgos_sys_config_get_hub_spool_max_size();
+  while (s_total_size > max_size && s_segs.size() > 1) {
+    const SpoolSegment &seg = s_segs.front();
+    int n = (seg.size - s_read_offset) / sizeof(ReportPoint);
+    LOG(LL_INFO, ("Spool full, evicting %d records", n));
+    s_stats.evicted += n;
+    hub_spool_remove_first();
+  }
+}
+
+bool hub_spool_is_empty(void) {
+  return (s_segs.empty() || hub_spool_num_records() == 0);
+}
+
+size_t hub_spool_write(const std::vector<ReportPoint> &points,
+                       uint64_t *first) {
+  *first = s_next_rec;
+  if (!mgos_sys_config_get_hub_spool_enable()) return 0;
+  if (mgos_sys_config_get_hub_spool_file_prefix() == nullptr) return 0;
+  const size_t seg_size = hub_spool_seg_size();
+  size_t num_written = 0;
+  FILE *fp = nullptr;
+  for (const ReportPoint &p : points) {
+    if (!s_append || s_segs.back().size + sizeof(p) > seg_size) {
+      if (fp != nullptr) {
+        fclose(fp);
+        fp = nullptr;
+      }
+      s_segs.push_back({s_next_seq++, 0, s_next_rec});
+      s_append = true;
+    }
+    SpoolSegment &seg = s_segs.back();
+    if (fp == nullptr) {
+      fp = fopen(hub_spool_seg_name(seg.seq).c_str(), "ab");
+      if (fp == nullptr) {
+        LOG(LL_ERROR, ("Failed to open spool segment %u", seg.seq));
+        s_stats.errors++;
+        s_append = false;
+        break;
+      }
+    }
+    if (fwrite(&p, sizeof(p), 1, fp) != 1) {
+      LOG(LL_ERROR, ("Failed to write spool segment %u", seg.seq));
+      s_stats.errors++;
+      s_append = false;
+      break;
+    }
+    seg.size += sizeof(p);
+    s_total_size += sizeof(p);
+    s_next_rec++;
+    s_stats.written++;
+    num_written++;
+  }
+  if (fp != nullptr) fclose(fp);
+  hub_spool_evict();
+  return num_written;
+}
+
+void hub_spool_cancel(uint64_t first, size_t num) {
+  const ReportPoint cancelled = {-1, 0, 0, 0};
+  for (const SpoolSegment &seg : s_segs) {
+    // Only unread records, the front segment is read from s_read_offset.
+    uint64_t from = seg.first;
+    if (&seg == &s_segs.front()) from += s_read_offset / sizeof(ReportPoint);
+    from = std::max(from, first);
+    const uint64_t to =
+        std::min(seg.first + seg.size / sizeof(ReportPoint), first + num);
+    if (from >= to) continue;
+    FILE *fp = fopen(hub_spool_seg_name(seg.seq).c_str(), "r+b");
+    if (fp == nullptr ||
+        fseek(fp, (from - seg.first) * sizeof(ReportPoint), SEEK_SET) != 0) {
+      LOG(LL_ERROR, ("Failed to open spool segment %u", seg.seq));
+      s_stats.errors++;
+      if (fp != nullptr) fclose(fp);
+      continue;
+    }
+    for (uint64_t i = from; i < to; i++) {
+      if (fwrite(&cancelled, sizeof(cancelled), 1, fp) != 1) {
+        LOG(LL_ERROR, ("Failed to write spool segment %u", seg.seq));
+        s_stats.errors++;
+        break;
+      }
+      s_stats.cancelled++;
+    }
+    fclose(fp);
+  }
+}
+
+bool hub_spool_read(int max_points, std::vector<ReportPoint> *points) {
+  points->clear();
+  while (points->empty()) {
+    // Skip empty and fully consumed segments.
+    while (!s_segs.empty() && s_segs.front().size <= s_read_offset) {
+      if (s_segs.size() == 1 && s_append) return false;
+      hub_spool_remove_first();
+    }
+    if (s_segs.empty()) return false;
+    const SpoolSegment &seg = s_segs.front();
+    size_t n = std::min<size_t>(
+        max_points, (seg.size - s_read_offset) / sizeof(ReportPoint));
+    FILE *fp = fopen(hub_spool_seg_name(seg.seq).c_str(), "rb");
+    if (fp == nullptr) {
+      LOG(LL_ERROR, ("Failed to open spool segment %u", seg.seq));
+      s_stats.errors++;
+      hub_spool_remove_first();
+      return false;
+    }
+    points->resize(n);
+    if (fseek(fp, s_read_offset, SEEK_SET) != 0 ||
+        fread(points->data(), sizeof(ReportPoint), n, fp) != n) {
+      LOG(LL_ERROR, ("Failed to read spool segment %u", seg.seq));
+      s_stats.errors++;
+      fclose(fp);
+      points->clear();
+      hub_spool_remove_first();
+      return false;
+    }
+    fclose(fp);
+    const auto cancelled = [](const ReportPoint &p) { return p.sid < 0; };
+    points->erase(std::remove_if(points->begin(), points->end(), cancelled),
+                  points->end());
+    s_read_seq = seg.seq;
+    s_read_pos = s_read_offset;
+    s_read_len = n;
+    s_read_points = points->size();
+    // All cancelled, nothing to send.
+    if (points->empty()) hub_spool_commit();
+  }
+  return true;
+}
+
+void hub_spool_commit(void) {
+  // Data may have been evicted while the batch was in flight.
+  if (s_segs.empty()) return;
+  SpoolSegment &seg = s_segs.front();
+  if (seg.seq != s_read_seq || s_read_offset != s_read_pos) return;
+  s_read_offset += s_read_len * sizeof(ReportPoint);
+  s_stats.replayed += s_read_points;
+  if (s_read_offset >= seg.size && !(s_segs.size() == 1 && s_append)) {
+    hub_spool_remove_first();
+  }
+}
+
+static void hub_spool_status_handler(struct mg_rpc_request_info *ri,
+                                     void *cb_arg UNUSED_ARG,
+                                     struct mg_rpc_frame_info *fi UNUSED_ARG,
+                                     struct mg_str args UNUSED_ARG) {
+  mg_rpc_send_responsef(ri,
+                        "{records: %d, size: %d, segments: %d, written: %u, "
+                        "replayed: %u, evicted: %u, cancelled: %u, "
+                        "errors: %u}",
+                        (int) hub_spool_num_records(), (int) s_total_size,
+                        (int) s_segs.size(), s_stats.written,
+                        s_stats.replayed, s_stats.evicted, s_stats.cancelled,
+                        s_stats.errors);
+}
+
+static void hub_spool_scan(const char *prefix) {
+  std::vector<unsigned int> seqs;
+  size_t plen = strlen(prefix);
+  DIR *dir = opendir("/");
+  if (dir == nullptr) return;
+  struct dirent *de;
+  while ((de = readdir(dir)) != nullptr) {
+    const char *name = de->d_name;
+    if (strncmp(name, prefix, plen) != 0 || name[plen] != '.') continue;
+    char *end = nullptr;
+    unsigned long seq = strtoul(name + plen + 1, &end, 10);
+    if (end == name + plen + 1 || *end != '\0') continue;
+    seqs.push_back(seq);
+  }
+  closedir(dir);
+  std::sort(seqs.begin(), seqs.end());
+  for (unsigned int seq : seqs) {
+    struct stat st;
+    if (stat(hub_spool_seg_name(seq).c_str(), &st) != 0) continue;
+    size_t size = st.st_size - st.st_size % sizeof(ReportPoint);
+    s_segs.push_back({seq, size, s_next_rec});
+    s_total_size += size;
+    s_next_rec += size / sizeof(ReportPoint);
+    s_next_seq = seq + 1;
+  }
+}
+
+bool hub_spool_init(void) {
+  const char *prefix = mgos_sys_config_get_hub_spool_file_prefix();
+  if (prefix != nullptr) {
+    hub_spool_scan(prefix);
+  }
+  if (!hub_spool_is_empty()) {
+    LOG(LL_INFO, ("Spool: %d records in %d segments",
+                  (int) hub_spool_num_records(), (int) s_segs.size()));
+  }
+  struct mg_rpc *c = mgos_rpc_get_global();
+  mg_rpc_add_handler(c, "Hub.Spool.Status", "", hub_spool_status_handler,
+                     NULL);
+  return true;
+}
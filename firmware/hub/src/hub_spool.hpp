@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "hub_report.hpp"
+
+// Appends points to the spool, evicting oldest data if over the size limit.
+// Returns the number of records written, *first is set to the index
+// of the first one.
+size_t hub_spool_write(const std::vector<ReportPoint> &points,
+                       uint64_t *first);
+
+// Marks num records starting at first as not to be replayed, e.g. because
+// they have been delivered after all. Records already read are not affected.
+void hub_spool_cancel(uint64_t first, size_t num);
+
+// Reads up to max_points oldest points from the spool.
+// Points are not removed until hub_spool_commit() is called.
+bool hub_spool_read(int max_points, std::vector<ReportPoint> *points);
+
+// Removes the points returned by the last hub_spool_read() from the spool.
+void hub_spool_commit(void);
+
+bool hub_spool_is_empty(void);
+
+bool hub_spool_init(void);
@@ -0,0 +1,373 @@
+#include "hub_stats.hpp"
+
+#include <cstdarg>
+#include <cstdlib>
+#include <cstring>
+
+#include "mgos.hpp"
+#include "mgos_http_server.h"
+#include "mgos_rpc.h"
+#include "mgos_system.h"
+#include "mgos_time.h"
+#include "mgos_timers.h"
+
+#include "hub_control.hpp"
+#include "hub_data.hpp"
+
+// Upper bounds of the histogram buckets, in microseconds.
+// Values above the last one go to an extra overflow bucket.
+static const int64_t s_bounds[] = {
+    100,     250,     500,      1000,     2500,    5000,
+    10000,   25000,   50000,    100000,   250000,  500000,
+    1000000, 2500000, 5000000,  10000000, 30000000, 60000000,
+};
+
+#define NUM_BOUNDS (sizeof(s_bounds) / sizeof(s_bounds[0]))
+
+// Sensor entries per chunk of /metrics, about 100 bytes each.
+#define METRICS_CHUNK_ENTRIES 20
+
+struct LatencyHistogram {
+  uint32_t buckets[NUM_BOUNDS + 1];
+  uint32_t count;
+  int64_t sum;
+  int64_t max;
+};
+
+static const char *s_stage_names[HUB_LAT_MAX] = {
+    "net", "queue", "eval", "act", "total",
+};
+
+struct HubCounters g_hub_counters;
+
+static struct LatencyHistogram s_hist[HUB_LAT_MAX];
+static int64_t s_rx_micros = 0;
+
+void hub_stats_add_latency(enum hub_latency_stage stage, int64_t micros) {
+  struct LatencyHistogram *h = &s_hist[stage];
+  if (micros < 0) micros = 0;  // Sensor clock is ahead.
+  size_t i = 0;
+  while (i < NUM_BOUNDS && micros > s_bounds[i]) i++;
+  h->buckets[i]++;
+  h->count++;
+  h->sum += micros;
+  if (micros > h->max) h->max = micros;
+}
+
+void hub_stats_rx_begin(double sensor_ts) {
+  s_rx_micros = mgos_uptime_micros();
+  if (sensor_ts > 0) {
+    hub_stats_add_latency(HUB_LAT_NET, (mg_time() - sensor_ts) * 1000000);
+  }
+}
+
+void hub_stats_rx_end(void) {
+  s_rx_micros = 0;
+}
+
+int64_t hub_stats_rx_micros(void) {
+  return s_rx_micros;
+}
+
+void hub_stats_add_source_points(const struct mg_str *src, unsigned int n) {
+  struct HubCounters *c = &g_hub_counters;
+  uint32_t ns = c->num_sources.load(std::memory_order_acquire);
+  for (uint32_t i = 0; i < ns; i++) {
+    if (mg_vcmp(src, c->sources[i].name) == 0) {
+      c->sources[i].points.fetch_add(n, std::memory_order_relaxed);
+      return;
+    }
+  }
+  if (ns == HUB_STATS_MAX_SOURCES || src->len >= HUB_STATS_SOURCE_LEN) {
+    c->rx_other_sources.fetch_add(n, std::memory_order_relaxed);
+    return;
+  }
+  memcpy(c->sources[ns].name, src->p, src->len);
+  c->sources[ns].name[src->len] = '\0';
+  c->sources[ns].points.store(n, std::memory_order_relaxed);
+  c->num_sources.store(ns + 1, std::memory_order_release);
+}
+
+static void hub_stats_update_heap(void) {
+  g_hub_counters.heap_free = mgos_get_free_heap_size();
+  g_hub_counters.heap_min_free = mgos_get_min_free_heap_size();
+}
+
+#define LOAD(name) g_hub_counters.name.load(std::memory_order_relaxed)
+
+void hub_stats_counters_json(std::string *out) {
+  const struct HubCounters *c = &g_hub_counters;
+  hub_stats_update_heap();
+  mgos::JSONAppendStringf(
+      out,
+      "{rx: {data: %u, data_multi: %u, data_bin: %u, errors: %u, old: %u, "
+      "late: %u, dup: %u, relay_dropped: %u, throttled: %u, coalesced: %u, "
+      "rejected: %u, sources: {",
+      LOAD(rx_data), LOAD(rx_data_multi), LOAD(rx_data_bin), LOAD(rx_errors),
+      LOAD(rx_old), LOAD(rx_late), LOAD(rx_dup), LOAD(rx_relay_dropped),
+      LOAD(rx_throttled), LOAD(rx_coalesced), LOAD(rx_rejected));
+  uint32_t ns = c->num_sources.load(std::memory_order_acquire);
+  for (uint32_t i = 0; i < ns; i++) {
+    mgos::JSONAppendStringf(out, "%s%Q: %u", (i > 0 ? ", " : ""),
+                            c->sources[i].name, LOAD(sources[i].points));
+  }
+  mgos::JSONAppendStringf(
+      out,
+      "}, other_sources: %u}, report: {sent: %u, failed: %u}, "
+      "eval: {passes: %u, total_us: %llu}, control_saves: %u, "
+      "heap: {free: %u, min_free: %u}}",
+      LOAD(rx_other_sources), LOAD(report_sent), LOAD(report_failed),
+      LOAD(eval_passes), (unsigned long long) LOAD(eval_micros),
+      LOAD(control_saves), LOAD(heap_free), LOAD(heap_min_free));
+}
+
+void hub_stats_prom_printf(struct mbuf *out, const char *fmt, ...) {
+  char buf[100], *p = buf;
+  va_list ap;
+  va_start(ap, fmt);
+  int len = mg_avprintf(&p, sizeof(buf), fmt, ap);
+  va_end(ap);
+  if (len > 0) mbuf_append(out, p, len);
+  if (p != buf) free(p);
+}
+
+void hub_stats_prom_header(struct mbuf *out, const char *name,
+                           const char *type, const char *help) {
+  hub_stats_prom_printf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name,
+                        type);
+}
+
+std::string hub_stats_prom_escape(const char *s) {
+  std::string res;
+  for (; *s != '\0'; s++) {
+    if (*s == '\\' || *s == '"') {
+      res.push_back('\\');
+      res.push_back(*s);
+    } else if (*s == '\n') {
+      res.append("\\n");
+    } else {
+      res.push_back(*s);
+    }
+  }
+  return res;
+}
+
+void hub_stats_counters_prometheus(struct mbuf *out) {
+  const struct HubCounters *c = &g_hub_counters;
+  hub_stats_update_heap();
+  hub_stats_prom_header(out, "hub_rx_points_total", "counter",
+                        "Data points received, by RPC method.");
+  hub_stats_prom_printf(out,
+                        "hub_rx_points_total{method=\"Sensor.Data\"} %u\n"
+                        "hub_rx_points_total{method=\"Sensor.DataMulti\"} %u\n"
+                        "hub_rx_points_total{method=\"Sensor.DataBin\"} %u\n",
+                        LOAD(rx_data), LOAD(rx_data_multi), LOAD(rx_data_bin));
+  hub_stats_prom_header(out, "hub_rx_source_points_total", "counter",
+                        "Data points received, by RPC source.");
+  uint32_t ns = c->num_sources.load(std::memory_order_acquire);
+  for (uint32_t i = 0; i < ns; i++) {
+    hub_stats_prom_printf(out, "hub_rx_source_points_total{source=\"%s\"} %u\n",
+                          hub_stats_prom_escape(c->sources[i].name).c_str(),
+                          LOAD(sources[i].points));
+  }
+  hub_stats_prom_header(
+      out, "hub_rx_other_source_points_total", "counter",
+      "Data points received from sources beyond the tracked ones.");
+  hub_stats_prom_printf(out, "hub_rx_other_source_points_total %u\n",
+                        LOAD(rx_other_sources));
+  hub_stats_prom_header(out, "hub_rx_errors_total", "counter",
+                        "Data points rejected as invalid.");
+  hub_stats_prom_printf(out, "hub_rx_errors_total %u\n", LOAD(rx_errors));
+  hub_stats_prom_header(out, "hub_rx_old_total", "counter",
+                        "Data points older than current data of the sensor.");
+  hub_stats_prom_printf(out, "hub_rx_old_total %u\n", LOAD(rx_old));
+  hub_stats_prom_header(out, "hub_rx_late_total", "counter",
+                        "Data points older than current data of the sensor "
+                        "added to history.");
+  hub_stats_prom_printf(out, "hub_rx_late_total %u\n", LOAD(rx_late));
+  hub_stats_prom_header(out, "hub_rx_dedup_total", "counter",
+                        "Data points dropped by deduplication, by reason.");
+  hub_stats_prom_printf(out,
+                        "hub_rx_dedup_total{reason=\"dup\"} %u\n"
+                        "hub_rx_dedup_total{reason=\"relay\"} %u\n",
+                        LOAD(rx_dup), LOAD(rx_relay_dropped));
+  hub_stats_prom_header(out, "hub_rx_throttled_total", "counter",
+                        "Data points held back by the per-sensor rate limit, "
+                        "by action.");
+  hub_stats_prom_printf(out,
+                        "hub_rx_throttled_total{action=\"drop\"} %u\n"
+                        "hub_rx_throttled_total{action=\"coalesce\"} %u\n",
+                        LOAD(rx_throttled), LOAD(rx_coalesced));
+  hub_stats_prom_header(out, "hub_rx_rejected_requests_total", "counter",
+                        "Data requests rejected by the per-source rate limit.");
+  hub_stats_prom_printf(out, "hub_rx_rejected_requests_total %u\n",
+                        LOAD(rx_rejected));
+  hub_stats_prom_header(out, "hub_report_points_total", "counter",
+                        "Data points reported to the data server, by result.");
+  hub_stats_prom_printf(out,
+                        "hub_report_points_total{result=\"sent\"} %u\n"
+                        "hub_report_points_total{result=\"failed\"} %u\n",
+                        LOAD(report_sent), LOAD(report_failed));
+  hub_stats_prom_header(out, "hub_eval_passes_total", "counter",
+                        "Control evaluation passes.");
+  hub_stats_prom_printf(out, "hub_eval_passes_total %u\n", LOAD(eval_passes));
+  hub_stats_prom_header(out, "hub_eval_seconds_total", "counter",
+                        "Time spent in control evaluation.");
+  hub_stats_prom_printf(out, "hub_eval_seconds_total %.6lf\n",
+                        LOAD(eval_micros) / 1000000.0);
+  hub_stats_prom_header(out, "hub_control_saves_total", "counter",
+                        "Saves of the control table.");
+  hub_stats_prom_printf(out, "hub_control_saves_total %u\n",
+                        LOAD(control_saves));
+  hub_stats_prom_header(out, "hub_heap_free_bytes", "gauge", "Free heap.");
+  hub_stats_prom_printf(out, "hub_heap_free_bytes %u\n", LOAD(heap_free));
+  hub_stats_prom_header(out, "hub_heap_min_free_bytes", "gauge",
+                        "Low-water mark of free heap.");
+  hub_stats_prom_printf(out, "hub_heap_min_free_bytes %u\n",
+                        LOAD(heap_min_free));
+}
+
+void hub_stats_latency_prometheus(struct mbuf *out) {
+  hub_stats_prom_header(out, "hub_latency_seconds", "histogram",
+                        "Latency of the stages from sensor to output.");
+  for (int s = 0; s < HUB_LAT_MAX; s++) {
+    const struct LatencyHistogram *h = &s_hist[s];
+    uint32_t n = 0;
+    for (size_t i = 0; i < NUM_BOUNDS; i++) {
+      n += h->buckets[i];
+      hub_stats_prom_printf(
+          out, "hub_latency_seconds_bucket{stage=\"%s\",le=\"%g\"} %u\n",
+          s_stage_names[s], s_bounds[i] / 1000000.0, n);
+    }
+    hub_stats_prom_printf(
+        out,
+        "hub_latency_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %u\n"
+        "hub_latency_seconds_sum{stage=\"%s\"} %.6lf\n"
+        "hub_latency_seconds_count{stage=\"%s\"} %u\n",
+        s_stage_names[s], h->count, s_stage_names[s], h->sum / 1000000.0,
+        s_stage_names[s], h->count);
+  }
+}
+
+static void hub_stats_handler(struct mg_rpc_request_info *ri,
+                              void *cb_arg UNUSED_ARG,
+                              struct mg_rpc_frame_info *fi UNUSED_ARG,
+                              struct mg_str args) {
+  char *format = nullptr;
+  json_scanf(args.p, args.len, ri->args_fmt, &format);
+  mgos::ScopedCPtr format_owner(format);
+  if (format == nullptr || strcmp(format, "json") == 0) {
+    std::string res;
+    hub_stats_counters_json(&res);
+    mg_rpc_send_responsef(ri, "%s", res.c_str());
+  } else if (strcmp(format, "prometheus") == 0) {
+    struct mbuf mb;
+    mbuf_init(&mb, 0);
+    hub_stats_counters_prometheus(&mb);
+    mg_rpc_send_responsef(ri, "{text: %.*Q}", (int) mb.len, mb.buf);
+    mbuf_free(&mb);
+  } else {
+    mg_rpc_send_errorf(ri, -1, "invalid format %s", format);
+  }
+}
+
+// Next section of the metrics, in hub_stats_metrics_next() order.
+struct MetricsCursor {
+  int section = 0;
+  struct DataMetricsPos data;
+};
+
+// Appends the next section to the connection's send buffer.
+static void hub_stats_metrics_next(struct mg_connection *nc,
+                                   struct MetricsCursor *c) {
+  struct mbuf *out = &nc->send_mbuf;
+  switch (c->section) {
+    case 0:
+      if (hub_data_metrics(out, &c->data, METRICS_CHUNK_ENTRIES)) return;
+      break;
+    case 1:
+      HubControlMetrics(out);
+      break;
+    case 2:
+      hub_stats_counters_prometheus(out);
+      break;
+    case 3:
+      hub_stats_latency_prometheus(out);
+      break;
+    default:
+      nc->flags |= MG_F_SEND_AND_CLOSE;
+      return;
+  }
+  c->section++;
+}
+
+static void hub_stats_metrics_send_handler(struct mg_connection *nc, int ev,
+                                           void *ev_data UNUSED_ARG,
+                                           void *user_data UNUSED_ARG) {
+  struct MetricsCursor *c = static_cast<struct MetricsCursor *>(nc->user_data);
+  switch (ev) {
+    case MG_EV_POLL:
+    case MG_EV_SEND:
+      // Only once what has been appended so far is sent.
+      if (nc->send_mbuf.len == 0) hub_stats_metrics_next(nc, c);
+      break;
+    case MG_EV_CLOSE:
+      delete c;
+      nc->user_data = nullptr;
+      break;
+  }
+}
+
+// Metrics are printed into the connection's send buffer a section at a
+// time, so that the whole exposition is never in memory at once.
+static void hub_stats_metrics_handler(struct mg_connection *nc, int ev,
+                                      void *ev_data UNUSED_ARG,
+                                      void *user_data UNUSED_ARG) {
+  if (ev != MG_EV_HTTP_REQUEST) return;
+  mg_send_response_line(nc, 200,
+                        "Content-Type: text/plain; version=0.0.4\r\n"
+                        "Connection: close");
+  mg_printf(nc, "\r\n");
+  nc->user_data = new MetricsCursor();
+  nc->handler = hub_stats_metrics_send_handler;
+}
+
+static void hub_stats_latency_handler(struct mg_rpc_request_info *ri,
+                                      void *cb_arg UNUSED_ARG,
+                                      struct mg_rpc_frame_info *fi UNUSED_ARG,
+                                      struct mg_str args) {
+  bool reset = false;
+  json_scanf(args.p, args.len, ri->args_fmt, &reset);
+
+  std::string res("{bounds_us: [");
+  for (size_t i = 0; i < NUM_BOUNDS; i++) {
+    mgos::JSONAppendStringf(&res, "%s%lld", (i > 0 ? ", " : ""),
+                            (long long) s_bounds[i]);
+  }
+  res.append("]");
+  for (int s = 0; s < HUB_LAT_MAX; s++) {
+    const struct LatencyHistogram *h = &s_hist[s];
+    mgos::JSONAppendStringf(
+        &res, ", %s: {count: %u, avg_us: %lld, max_us: %lld, buckets: [",
+        s_stage_names[s], h->count,
+        (long long) (h->count > 0 ? h->sum / h->count : 0),
+        (long long) h->max);
+    for (size_t i = 0; i < NUM_BOUNDS + 1; i++) {
+      mgos::JSONAppendStringf(&res, "%s%u", (i > 0 ? ", " : ""),
+                              h->buckets[i]);
+    }
+    res.append("]}");
+  }
+  res.append("}");
+  if (reset) memset(s_hist, 0, sizeof(s_hist));
+  mg_rpc_send_responsef(ri, "%s", res.c_str());
+}
+
+bool hub_stats_init(void) {
+  struct mg_rpc *c = mgos_rpc_get_global();
+  mg_rpc_add_handler(c, "Hub.Stats", "{format: %Q}", hub_stats_handler, NULL);
+  mg_rpc_add_handler(c, "Hub.Stats.Latency", "{reset: %B}",
+                     hub_stats_latency_handler, NULL);
+  mgos_register_http_endpoint("/metrics", hub_stats_metrics_handler, NULL);
+  return true;
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+struct mbuf;
+struct mg_str;
+
+// Stages of the path from a sensor taking a reading to an output changing.
+enum hub_latency_stage {
+  // Sensor timestamp to receipt by the hub (includes clock skew).
+  HUB_LAT_NET = 0,
+  // Receipt to start of evaluation of the limits that use the data.
+  HUB_LAT_QUEUE,
+  // Evaluation of the limits.
+  HUB_LAT_EVAL,
+  // Evaluation result to output state written.
+  HUB_LAT_ACT,
+  // Receipt to output state written.
+  HUB_LAT_TOTAL,
+  HUB_LAT_MAX,
+};
+
+void hub_stats_add_latency(enum hub_latency_stage stage, int64_t micros);
+
+// Data is processed synchronously, from receipt to actuation.
+// Receipt time is kept for the duration so later stages can refer to it.
+void hub_stats_rx_begin(double sensor_ts);
+void hub_stats_rx_end(void);
+// Uptime in microseconds when the data being processed was received,
+// 0 if not processing received data.
+int64_t hub_stats_rx_micros(void);
+
+#define HUB_STATS_MAX_SOURCES 8
+#define HUB_STATS_SOURCE_LEN 32
+
+// Load counters. Counters are bumped from the mgos task but may be read
+// from anywhere, hence atomics. Relaxed ordering is sufficient for them.
+struct HubCounters {
+  // Points received via Sensor.Data, Sensor.DataMulti and Sensor.DataBin.
+  std::atomic<uint32_t> rx_data{0};
+  std::atomic<uint32_t> rx_data_multi{0};
+  std::atomic<uint32_t> rx_data_bin{0};
+  // Points that failed to parse and that were older than current data.
+  std::atomic<uint32_t> rx_errors{0};
+  std::atomic<uint32_t> rx_old{0};
+  // Points older than current data that were added to history.
+  std::atomic<uint32_t> rx_late{0};
+  // Points dropped as duplicates and as coming from a non-preferred relay.
+  std::atomic<uint32_t> rx_dup{0};
+  std::atomic<uint32_t> rx_relay_dropped{0};
+  // Points dropped and coalesced by the per-sensor rate limit, requests
+  // rejected by the per-source one.
+  std::atomic<uint32_t> rx_throttled{0};
+  std::atomic<uint32_t> rx_coalesced{0};
+  std::atomic<uint32_t> rx_rejected{0};
+  // Points received from each RPC source, first come first served.
+  // Name is written once, before num_sources is incremented.
+  struct {
+    char name[HUB_STATS_SOURCE_LEN];
+    std::atomic<uint32_t> points{0};
+  } sources[HUB_STATS_MAX_SOURCES];
+  std::atomic<uint32_t> num_sources{0};
+  std::atomic<uint32_t> rx_other_sources{0};
+  // Points reported upstream.
+  std::atomic<uint32_t> report_sent{0};
+  std::atomic<uint32_t> report_failed{0};
+  // Control evaluation passes and the total time spent in them.
+  std::atomic<uint32_t> eval_passes{0};
+  std::atomic<uint64_t> eval_micros{0};
+  std::atomic<uint32_t> control_saves{0};
+  // Updated when exported.
+  std::atomic<uint32_t> heap_free{0};
+  std::atomic<uint32_t> heap_min_free{0};
+};
+
+extern struct HubCounters g_hub_counters;
+
+#define HUB_COUNTER_ADD(name, n) \
+  g_hub_counters.name.fetch_add((n), std::memory_order_relaxed)
+#define HUB_COUNTER_INC(name) HUB_COUNTER_ADD(name, 1)
+
+void hub_stats_add_source_points(const struct mg_str *src, unsigned int n);
+
+void hub_stats_counters_json(std::string *out);
+
+// Metrics in Prometheus text exposition format, served at /metrics.
+void hub_stats_counters_prometheus(struct mbuf *out);
+void hub_stats_latency_prometheus(struct mbuf *out);
+void hub_stats_prom_printf(struct mbuf *out, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+// Prints the HELP and TYPE lines.
+void hub_stats_prom_header(struct mbuf *out, const char *name,
+                           const char *type, const char *help);
+// Escapes a label value.
+std::string hub_stats_prom_escape(const char *s);
+
+bool hub_stats_init(void);
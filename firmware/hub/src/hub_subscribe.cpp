@@ -0,0 +1,306 @@
+#include "hub_subscribe.hpp"
+
+#include <cmath>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mgos.hpp"
+#include "mgos_rpc.h"
+#include "mgos_timers.hpp"
+
+#include "hub_data.hpp"
+
+#define NOTIFY_METHOD "Hub.Data.Notify"
+
+struct SidRange {
+  int min;
+  int max;
+};
+
+// A subscriber and its filter. Changes are queued and sent in batches,
+// at most one notification is in flight. Queue holds at most one change
+// per sensor and is bounded, so ingest never waits for the subscriber.
+class Subscription {
+ public:
+  Subscription(int id, const std::string &dst);
+
+  int id() const;
+  const std::string &dst() const;
+  bool Matches(const SensorData *sd) const;
+  void Add(const SensorData *sd);
+  void Flush();
+  void SendDone(bool ok);
+
+  // Empty means any.
+  std::vector<SidRange> sids;
+  std::vector<int> subids;
+  double min_delta = 0;
+
+ private:
+  const int id_;
+  const std::string dst_;
+  std::map<uint64_t, SensorData> pending_;
+  // Last value sent for each sensor, for min_delta.
+  std::map<uint64_t, double> sent_;
+  // Changes dropped since the last notification.
+  unsigned int dropped_ = 0;
+  bool in_flight_ = false;
+  double sent_uts_ = 0;
+  mgos::Timer timer_;
+};
+
+static std::vector<std::unique_ptr<Subscription>> s_subs;
+static int s_next_id = 1;
+
+static Subscription *find_sub(int id) {
+  for (auto &sub : s_subs) {
+    if (sub->id() == id) return sub.get();
+  }
+  return nullptr;
+}
+
+// Subscription may be gone by the time the response arrives.
+static void hub_subscribe_result_cb(struct mg_rpc *c UNUSED_ARG, void *cb_arg,
+                                    struct mg_rpc_frame_info *fi UNUSED_ARG,
+                                    struct mg_str result UNUSED_ARG,
+                                    int error_code,
+                                    struct mg_str error_msg UNUSED_ARG) {
+  Subscription *sub = find_sub((intptr_t) cb_arg);
+  if (sub != nullptr) sub->SendDone(error_code == 0);
+}
+
+Subscription::Subscription(int id, const std::string &dst)
+    : id_(id), dst_(dst), timer_(std::bind(&Subscription::Flush, this)) {
+}
+
+int Subscription::id() const {
+  return id_;
+}
+
+const std::string &Subscription::dst() const {
+  return dst_;
+}
+
+bool Subscription::Matches(const SensorData *sd) const {
+  bool sid_ok = sids.empty();
+  for (const SidRange &r : sids) {
+    if (sd->sid >= r.min && sd->sid <= r.max) {
+      sid_ok = true;
+      break;
+    }
+  }
+  if (!sid_ok) return false;
+  if (subids.empty()) return true;
+  for (int subid : subids) {
+    if (sd->subid == subid) return true;
+  }
+  return false;
+}
+
+void Subscription::Add(const SensorData *sd) {
+  const uint64_t key = sd->GetKey();
+  auto it = pending_.find(key);
+  if (it != pending_.end()) {
+    // Coalesce. Even if this one alone would not be sent, the queued value
+    // is outdated now.
+    it->second = *sd;
+    return;
+  }
+  if (min_delta > 0) {
+    auto sit = sent_.find(key);
+    if (sit != sent_.end() && std::fabs(sd->value - sit->second) < min_delta) {
+      return;
+    }
+  }
+  if ((int) pending_.size() >= mgos_sys_config_get_hub_subscribe_queue_len()) {
+    dropped_++;
+    return;
+  }
+  pending_.emplace(key, *sd);
+  if (!in_flight_ && !timer_.IsValid()) {
+    timer_.Reset(mgos_sys_config_get_hub_subscribe_delay_ms(), 0);
+  }
+}
+
+void Subscription::Flush() {
+  if (in_flight_) {
+    // Lost response, or the client does not send them. Keep going.
+    double timeout = mgos_sys_config_get_hub_subscribe_timeout();
+    if (mgos_uptime() - sent_uts_ < timeout) return;
+    in_flight_ = false;
+  }
+  if (pending_.empty() && dropped_ == 0) return;
+  struct mbuf mb;
+  mbuf_init(&mb, 50);
+  struct json_out out = JSON_OUT_MBUF(&mb);
+  for (const auto &it : pending_) {
+    const SensorData &sd = it.second;
+    if (mb.len > 0) json_printf(&out, ", ");
+    if (sd.name_id != HUB_NAME_NONE) {
+      json_printf(&out,
+                  "{sid: %d, subid: %d, name: %Q, ts: %.3lf, value: %.3lf}",
+                  sd.sid, sd.subid, sd.GetName(), sd.ts, sd.value);
+    } else {
+      json_printf(&out, "{sid: %d, subid: %d, ts: %.3lf, value: %.3lf}", sd.sid,
+                  sd.subid, sd.ts, sd.value);
+    }
+  }
+  struct mg_rpc_call_opts opts = {};
+  opts.dst = mg_mk_str(dst_.c_str());
+  opts.no_queue = true;
+  bool res = mg_rpc_callf(mgos_rpc_get_global(), mg_mk_str(NOTIFY_METHOD),
+                          hub_subscribe_result_cb, (void *) (intptr_t) id_,
+                          &opts, "{id: %d, data: [%.*s], dropped: %u}", id_,
+                          (int) mb.len, mb.buf);
+  mbuf_free(&mb);
+  if (res) {
+    for (const auto &it : pending_) {
+      sent_[it.first] = it.second.value;
+    }
+    dropped_ = 0;
+    in_flight_ = true;
+    sent_uts_ = mgos_uptime();
+    // In case the response never comes.
+    timer_.Reset(mgos_sys_config_get_hub_subscribe_timeout() * 1000, 0);
+  } else {
+    // Subscriber is not connected or cannot keep up.
+    LOG(LL_DEBUG, ("Sub %d: failed to send %d changes", id_,
+                   (int) pending_.size()));
+    dropped_ += pending_.size();
+  }
+  pending_.clear();
+}
+
+void Subscription::SendDone(bool ok) {
+  if (!ok) LOG(LL_DEBUG, ("Sub %d: notification failed", id_));
+  in_flight_ = false;
+  timer_.Clear();
+  if (!pending_.empty() || dropped_ > 0) {
+    timer_.Reset(mgos_sys_config_get_hub_subscribe_delay_ms(), 0);
+  }
+}
+
+static bool parse_int_token(const struct json_token *t, int *v) {
+  if (t->type != JSON_TYPE_NUMBER) return false;
+  *v = strtol(std::string(t->ptr, t->len).c_str(), nullptr, 0);
+  return true;
+}
+
+// sids: array of numbers or [min, max] ranges.
+static bool parse_sids(const struct json_token *st,
+                       std::vector<SidRange> *sids) {
+  struct json_token t;
+  for (int i = 0; json_scanf_array_elem(st->ptr, st->len, "", i, &t) > 0;
+       i++) {
+    SidRange r;
+    if (parse_int_token(&t, &r.min)) {
+      r.max = r.min;
+    } else {
+      struct json_token mint, maxt;
+      if (t.type != JSON_TYPE_ARRAY_END ||
+          json_scanf_array_elem(t.ptr, t.len, "", 0, &mint) <= 0 ||
+          json_scanf_array_elem(t.ptr, t.len, "", 1, &maxt) <= 0 ||
+          !parse_int_token(&mint, &r.min) || !parse_int_token(&maxt, &r.max)) {
+        return false;
+      }
+    }
+    sids->push_back(r);
+  }
+  return true;
+}
+
+static void hub_data_subscribe_handler(struct mg_rpc_request_info *ri,
+                                       void *cb_arg UNUSED_ARG,
+                                       struct mg_rpc_frame_info *fi UNUSED_ARG,
+                                       struct mg_str args) {
+  struct json_token sids = JSON_INVALID_TOKEN, subids = JSON_INVALID_TOKEN;
+  double min_delta = 0;
+  json_scanf(args.p, args.len, ri->args_fmt, &sids, &subids, &min_delta);
+
+  if (ri->src.len == 0) {
+    mg_rpc_send_errorf(ri, 400, "src is required");
+    return;
+  }
+  if ((int) s_subs.size() >= mgos_sys_config_get_hub_subscribe_max_subs()) {
+    mg_rpc_send_errorf(ri, 429, "too many subscriptions");
+    return;
+  }
+  std::unique_ptr<Subscription> sub(
+      new Subscription(s_next_id, std::string(ri->src.p, ri->src.len)));
+  if (sids.type == JSON_TYPE_ARRAY_END && !parse_sids(&sids, &sub->sids)) {
+    mg_rpc_send_errorf(ri, 400, "invalid sids");
+    return;
+  }
+  if (subids.type == JSON_TYPE_ARRAY_END) {
+    struct json_token t;
+    for (int i = 0;
+         json_scanf_array_elem(subids.ptr, subids.len, "", i, &t) > 0; i++) {
+      int subid;
+      if (!parse_int_token(&t, &subid)) {
+        mg_rpc_send_errorf(ri, 400, "invalid subids");
+        return;
+      }
+      sub->subids.push_back(subid);
+    }
+  }
+  sub->min_delta = min_delta;
+  LOG(LL_INFO, ("Sub %d: %s, %d sid ranges, %d subids, delta %.3lf",
+                sub->id(), sub->dst().c_str(), (int) sub->sids.size(),
+                (int) sub->subids.size(), sub->min_delta));
+  s_subs.push_back(std::move(sub));
+  mg_rpc_send_responsef(ri, "{id: %d}", s_next_id++);
+}
+
+static void hub_data_unsubscribe_handler(
+    struct mg_rpc_request_info *ri, void *cb_arg UNUSED_ARG,
+    struct mg_rpc_frame_info *fi UNUSED_ARG, struct mg_str args) {
+  int id = -1;
+  json_scanf(args.p, args.len, ri->args_fmt, &id);
+  for (auto it = s_subs.begin(); it != s_subs.end(); it++) {
+    if ((*it)->id() != id) continue;
+    LOG(LL_INFO, ("Sub %d: removed", id));
+    s_subs.erase(it);
+    mg_rpc_send_responsef(ri, NULL);
+    return;
+  }
+  mg_rpc_send_errorf(ri, 404, "Not Found");
+}
+
+static void hub_subscribe_data_cb(int ev UNUSED_ARG, void *ev_data,
+                                  void *userdata UNUSED_ARG) {
+  const struct SensorData *sd = static_cast<struct SensorData *>(ev_data);
+  for (auto &sub : s_subs) {
+    if (sub->Matches(sd)) sub->Add(sd);
+  }
+}
+
+// Subscriptions go away with the connection.
+static void hub_subscribe_channel_closed_cb(int ev UNUSED_ARG, void *ev_data,
+                                            void *userdata UNUSED_ARG) {
+  const struct mg_str *dst = static_cast<const struct mg_str *>(ev_data);
+  for (auto it = s_subs.begin(); it != s_subs.end();) {
+    if (mg_vcmp(dst, (*it)->dst().c_str()) == 0) {
+      LOG(LL_INFO, ("Sub %d: %s disconnected", (*it)->id(),
+                    (*it)->dst().c_str()));
+      it = s_subs.erase(it);
+    } else {
+      it++;
+    }
+  }
+}
+
+bool hub_subscribe_init(void) {
+  struct mg_rpc *c = mgos_rpc_get_global();
+  mg_rpc_add_handler(c, "Hub.Data.Subscribe",
+                     "{sids: %T, subids: %T, min_delta: %lf}",
+                     hub_data_subscribe_handler, NULL);
+  mg_rpc_add_handler(c, "Hub.Data.Unsubscribe", "{id: %d}",
+                     hub_data_unsubscribe_handler, NULL);
+  mgos_event_add_handler(HUB_EV_DATA, hub_subscribe_data_cb, NULL);
+  mgos_event_add_handler(MGOS_RPC_EV_CHANNEL_CLOSED,
+                         hub_subscribe_channel_closed_cb, NULL);
+  return true;
+}
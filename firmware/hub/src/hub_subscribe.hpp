@@ -0,0 +1,5 @@
+#pragma once
+
+// Pushes data changes to RPC clients that subscribed to them
+// with Hub.Data.Subscribe, as Hub.Data.Notify calls.
+bool hub_subscribe_init(void);
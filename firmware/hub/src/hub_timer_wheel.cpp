@@ -0,0 +1,97 @@
+#include "hub_timer_wheel.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "mgos.hpp"
+
+TimerWheel::TimerWheel(int num_slots, Handler handler)
+    : handler_(handler),
+      slots_(num_slots),
+      timer_(std::bind(&TimerWheel::Tick, this)) {
+}
+
+void TimerWheel::Schedule(uint64_t key, double deadline) {
+  const int64_t n = slots_.size();
+  if (deadlines_.empty()) {
+    last_tick_ = std::floor(cs_time());
+    timer_.Reset(1000, MGOS_TIMER_REPEAT);
+  }
+  // Fire strictly after the deadline.
+  const int64_t t = std::floor(deadline) + 1;
+  // Already expired, fire on the next tick.
+  const size_t slot = std::max(t, last_tick_ + 1) % n;
+  auto it = deadlines_.find(key);
+  if (it != deadlines_.end()) {
+    it->second.deadline = t;
+    // Frequent reschedules, e.g. on every data point, often stay in the
+    // same slot.
+    if (it->second.slot == slot) return;
+    RemoveFromSlot(key, it->second.slot);
+    it->second.slot = slot;
+  } else {
+    deadlines_.emplace(key, Entry{t, slot});
+  }
+  slots_[slot].push_back(key);
+}
+
+void TimerWheel::Cancel(uint64_t key) {
+  auto it = deadlines_.find(key);
+  if (it == deadlines_.end()) return;
+  RemoveFromSlot(key, it->second.slot);
+  deadlines_.erase(it);
+}
+
+void TimerWheel::RemoveFromSlot(uint64_t key, size_t slot) {
+  std::vector<uint64_t> &keys = slots_[slot];
+  auto it = std::find(keys.begin(), keys.end(), key);
+  if (it == keys.end()) return;
+  *it = keys.back();
+  keys.pop_back();
+}
+
+void TimerWheel::Clear() {
+  deadlines_.clear();
+  for (auto &slot : slots_) slot.clear();
+  timer_.Clear();
+}
+
+size_t TimerWheel::size() const {
+  return deadlines_.size();
+}
+
+void TimerWheel::ProcessSlot(size_t slot, int64_t now) {
+  std::vector<uint64_t> keep, expired;
+  for (uint64_t key : slots_[slot]) {
+    auto it = deadlines_.find(key);
+    if (it->second.deadline <= now) {
+      expired.push_back(key);
+      deadlines_.erase(it);
+    } else {
+      keep.push_back(key);  // Due on one of the next rounds.
+    }
+  }
+  slots_[slot].swap(keep);
+  // Handler may schedule new deadlines, including in this slot.
+  for (uint64_t key : expired) {
+    handler_(key);
+  }
+}
+
+void TimerWheel::Tick() {
+  const int64_t n = slots_.size();
+  const int64_t now = std::floor(cs_time());
+  if (now < last_tick_) {
+    last_tick_ = now;  // Clock went back.
+  } else if (now - last_tick_ > n) {
+    // Clock jumped forward (or we were stalled): check everything.
+    last_tick_ = now;
+    for (int64_t i = 0; i < n; i++) ProcessSlot(i, now);
+  } else {
+    while (last_tick_ < now) {
+      last_tick_++;
+      ProcessSlot(last_tick_ % n, last_tick_);
+    }
+  }
+  if (deadlines_.empty()) timer_.Clear();
+}
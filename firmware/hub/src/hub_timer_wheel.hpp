@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+#include "mgos_timers.hpp"
+
+// Hashed timing wheel of per-key deadlines with 1 second resolution.
+// Scheduling and cancelling are O(1), each tick only looks at one slot.
+// Deadlines are wall clock time, the wheel only ticks while non-empty.
+class TimerWheel {
+ public:
+  typedef std::function<void(uint64_t key)> Handler;
+
+  TimerWheel(int num_slots, Handler handler);
+
+  // Sets the deadline for the key, replacing the previous one.
+  void Schedule(uint64_t key, double deadline);
+  void Cancel(uint64_t key);
+  void Clear();
+  size_t size() const;
+
+ private:
+  struct Entry {
+    int64_t deadline;
+    size_t slot;
+  };
+
+  void Tick();
+  void ProcessSlot(size_t slot, int64_t now);
+  void RemoveFromSlot(uint64_t key, size_t slot);
+
+  const Handler handler_;
+  // Each scheduled key is in exactly one slot, the one in its entry.
+  std::vector<std::vector<uint64_t>> slots_;
+  std::unordered_map<uint64_t, Entry> deadlines_;
+  int64_t last_tick_ = 0;
+  mgos::Timer timer_;
+};
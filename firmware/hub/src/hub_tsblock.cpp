@@ -0,0 +1,191 @@
+#include "hub_tsblock.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#define TSBLOCK_VALUE_SCALE 1000.0
+
+static int64_t ts_to_int(double ts) {
+  return std::llround(ts);
+}
+
+static uint64_t value_to_int(double value) {
+  double q = std::round(value * TSBLOCK_VALUE_SCALE);
+  q = std::max(std::min(q, (double) INT64_MAX / 2), (double) INT64_MIN / 2);
+  return (uint64_t) (int64_t) q;
+}
+
+static double int_to_value(uint64_t q) {
+  return (int64_t) q / TSBLOCK_VALUE_SCALE;
+}
+
+TSBlock::TSBlock(size_t size) : data_(size) {
+}
+
+int TSBlock::count() const {
+  return count_;
+}
+
+double TSBlock::first_ts() const {
+  return t0_;
+}
+
+double TSBlock::last_ts() const {
+  return t_;
+}
+
+size_t TSBlock::data_size() const {
+  return (bits_ + 7) / 8;
+}
+
+size_t TSBlock::GetMemoryUsage() const {
+  return sizeof(*this) + data_.capacity();
+}
+
+// Delta of delta:
+//   0                  -> '0'
+//   [-63, 64]          -> '10' + 7 bits
+//   [-255, 256]        -> '110' + 9 bits
+//   [-2047, 2048]      -> '1110' + 12 bits
+//   anything else      -> '1111' + 32 bits
+// static
+int TSBlock::GetTSBits(int64_t dod) {
+  if (dod == 0) return 1;
+  if (dod >= -63 && dod <= 64) return 2 + 7;
+  if (dod >= -255 && dod <= 256) return 3 + 9;
+  if (dod >= -2047 && dod <= 2048) return 4 + 12;
+  return 4 + 32;
+}
+
+// XOR with the previous value:
+//   0 -> '0'
+//   meaningful bits fit in the previous window -> '10' + meaningful bits
+//   otherwise -> '11' + 6 bits of leading zeros + 6 bits of length + bits
+// Unlike the paper, 6 bits are used for leading zeros, our values are small
+// integers and typically have more than 32 leading zeros.
+int TSBlock::GetValueBits(uint64_t x) const {
+  if (x == 0) return 1;
+  int lead = __builtin_clzll(x), trail = __builtin_ctzll(x);
+  if (lead_ >= 0 && lead >= lead_ && trail >= trail_) {
+    return 2 + (64 - lead_ - trail_);
+  }
+  return 2 + 6 + 6 + (64 - lead - trail);
+}
+
+void TSBlock::WriteBits(uint64_t v, int n) {
+  while (n > 0) {
+    int avail = 8 - (bits_ & 7);
+    int take = std::min(n, avail);
+    uint8_t chunk = (v >> (n - take)) & ((1 << take) - 1);
+    data_[bits_ >> 3] |= chunk << (avail - take);
+    bits_ += take;
+    n -= take;
+  }
+}
+
+bool TSBlock::Append(double ts, double value) {
+  int64_t t = ts_to_int(ts);
+  uint64_t q = value_to_int(value);
+  if (count_ == 0) {
+    if (data_.size() < 8) return false;
+    t0_ = t_ = t;
+    q_ = q;
+    WriteBits(q, 64);
+    count_++;
+    return true;
+  }
+  int64_t delta = t - t_;
+  int64_t dod = delta - delta_;
+  uint64_t x = q ^ q_;
+  if (bits_ + GetTSBits(dod) + GetValueBits(x) > data_.size() * 8) {
+    return false;
+  }
+  if (dod == 0) {
+    WriteBits(0, 1);
+  } else if (dod >= -63 && dod <= 64) {
+    WriteBits(0b10, 2);
+    WriteBits(dod + 63, 7);
+  } else if (dod >= -255 && dod <= 256) {
+    WriteBits(0b110, 3);
+    WriteBits(dod + 255, 9);
+  } else if (dod >= -2047 && dod <= 2048) {
+    WriteBits(0b1110, 4);
+    WriteBits(dod + 2047, 12);
+  } else {
+    WriteBits(0b1111, 4);
+    WriteBits((uint32_t) (int32_t) dod, 32);
+  }
+  if (x == 0) {
+    WriteBits(0, 1);
+  } else {
+    int lead = __builtin_clzll(x), trail = __builtin_ctzll(x);
+    if (lead_ >= 0 && lead >= lead_ && trail >= trail_) {
+      WriteBits(0b10, 2);
+      WriteBits(x >> trail_, 64 - lead_ - trail_);
+    } else {
+      int len = 64 - lead - trail;
+      WriteBits(0b11, 2);
+      WriteBits(lead, 6);
+      WriteBits(len - 1, 6);
+      WriteBits(x >> trail, len);
+      lead_ = lead;
+      trail_ = trail;
+    }
+  }
+  t_ = t;
+  delta_ = delta;
+  q_ = q;
+  count_++;
+  return true;
+}
+
+TSBlock::Reader::Reader(const TSBlock &b) : b_(b) {
+}
+
+uint64_t TSBlock::Reader::ReadBits(int n) {
+  uint64_t v = 0;
+  while (n > 0) {
+    int avail = 8 - (pos_ & 7);
+    int take = std::min(n, avail);
+    uint8_t byte = b_.data_[pos_ >> 3];
+    uint8_t chunk = (byte >> (avail - take)) & ((1 << take) - 1);
+    v = (v << take) | chunk;
+    pos_ += take;
+    n -= take;
+  }
+  return v;
+}
+
+bool TSBlock::Reader::Next(double *ts, double *value) {
+  if (idx_ >= b_.count_) return false;
+  if (idx_ == 0) {
+    t_ = b_.t0_;
+    q_ = ReadBits(64);
+  } else {
+    int64_t dod;
+    if (ReadBits(1) == 0) {
+      dod = 0;
+    } else if (ReadBits(1) == 0) {
+      dod = (int64_t) ReadBits(7) - 63;
+    } else if (ReadBits(1) == 0) {
+      dod = (int64_t) ReadBits(9) - 255;
+    } else if (ReadBits(1) == 0) {
+      dod = (int64_t) ReadBits(12) - 2047;
+    } else {
+      dod = (int32_t) ReadBits(32);
+    }
+    delta_ += dod;
+    t_ += delta_;
+    if (ReadBits(1) != 0) {
+      if (ReadBits(1) != 0) {
+        lead_ = ReadBits(6);
+        trail_ = 64 - lead_ - ((int) ReadBits(6) + 1);
+      }
+      q_ ^= ReadBits(64 - lead_ - trail_) << trail_;
+    }
+  }
+  idx_++;
+  *ts = t_;
+  *value = int_to_value(q_);
+  return true;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A block of compressed time series data, as described in "Gorilla: A Fast,
+// Scalable, In-Memory Time Series Database" (Facebook, 2015).
+// Timestamps are delta-of-delta encoded, values are XOR'd with the previous
+// one and only the meaningful bits are stored.
+// Timestamps are stored with 1 s resolution, values with 0.001 precision,
+// as integers, which XOR much better than doubles of decimal fractions.
+// Points must be appended in order.
+class TSBlock {
+ public:
+  explicit TSBlock(size_t size);
+
+  // Returns false if there is not enough space left in the block.
+  bool Append(double ts, double value);
+
+  int count() const;
+  double first_ts() const;
+  double last_ts() const;
+  // Number of bytes of compressed data.
+  size_t data_size() const;
+  size_t GetMemoryUsage() const;
+
+  class Reader {
+   public:
+    explicit Reader(const TSBlock &b);
+    bool Next(double *ts, double *value);
+
+   private:
+    uint64_t ReadBits(int n);
+
+    const TSBlock &b_;
+    size_t pos_ = 0;
+    int idx_ = 0;
+    int64_t t_ = 0;
+    int64_t delta_ = 0;
+    uint64_t q_ = 0;
+    int lead_ = 0;
+    int trail_ = 0;
+  };
+
+ private:
+  static int GetTSBits(int64_t dod);
+  int GetValueBits(uint64_t x) const;
+  void WriteBits(uint64_t v, int n);
+
+  std::vector<uint8_t> data_;
+  size_t bits_ = 0;
+  int count_ = 0;
+  int64_t t0_ = 0;
+  int64_t t_ = 0;
+  int64_t delta_ = 0;
+  uint64_t q_ = 0;
+  int lead_ = -1;  // Not set yet.
+  int trail_ = 0;
+};
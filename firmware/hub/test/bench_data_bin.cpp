@@ -0,0 +1,117 @@
+// Sensor.DataBin vs Sensor.DataMulti: wire size and decode time.
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "hub_data_bin.hpp"
+#include "hub_data_multi.hpp"
+#include "hub_sensor_data.hpp"
+#include "hub_test.hpp"
+
+#define NUM_ITER 200
+
+// Names are not used here, hub_names.cpp needs mgos.
+const char *hub_name_get(uint16_t id) {
+  (void) id;
+  return "";
+}
+
+// A relay's backlog: 10 sensors with temperature and humidity.
+static std::vector<SensorData> make_points(int n) {
+  std::vector<SensorData> points;
+  double ts = 1600000000.123;
+  for (int i = 0; i < n; i++) {
+    const int sensor = (i / 2) % 10;
+    if (sensor == 0 && i % 2 == 0) ts += 10;
+    const double value = (i % 2 == 0 ? 21.5 + sensor * 0.3 : 45 + sensor);
+    points.emplace_back(0x3000000 + sensor, i % 2, ts + sensor * 0.01,
+                        std::round(value * 10) / 10);
+  }
+  return points;
+}
+
+// As sent by the relay, see BTSensor::Data::ToJSON.
+static std::string to_json(const std::vector<SensorData> &points) {
+  std::string json = "[";
+  for (const SensorData &sd : points) {
+    char buf[100];
+    snprintf(buf, sizeof(buf), "%s{sid: %u, subid: %u, ts: %.3f, v: %.1f}",
+             (json.size() > 1 ? ", " : ""), (unsigned) sd.sid,
+             (unsigned) sd.subid, sd.ts, sd.value);
+    json += buf;
+  }
+  json += "]";
+  return json;
+}
+
+static void bench(int n) {
+  const std::vector<SensorData> points = make_points(n);
+  const std::string json = to_json(points);
+  std::string bin;
+  hub_data_bin_encode(points, 1, &bin);
+  const size_t b64_size = (bin.size() + 2) / 3 * 4;
+
+  double start = hub_test_now_us();
+  for (int i = 0; i < NUM_ITER; i++) {
+    int j = 0;
+    int num = hub_data_multi_walk(
+        json.data(), json.size(), [&](const DataPoint &dp) {
+          CHECK(dp.sid == points[j].sid && dp.subid == points[j].subid);
+          CHECK(std::fabs(dp.ts - points[j].ts) < 0.0005);
+          CHECK(std::fabs(dp.value - points[j].value) < 0.05);
+          j++;
+          return true;
+        });
+    CHECK(num == n);
+  }
+  const double json_ns = (hub_test_now_us() - start) * 1000 / NUM_ITER / n;
+
+  start = hub_test_now_us();
+  for (int i = 0; i < NUM_ITER; i++) {
+    int j = 0;
+    int num = hub_data_bin_decode(
+        (const uint8_t *) bin.data(), bin.size(), [&](const SensorData &sd) {
+          CHECK(sd.sid == points[j].sid && sd.subid == points[j].subid);
+          CHECK(std::fabs(sd.ts - points[j].ts) < 0.0005);
+          CHECK(std::fabs(sd.value - points[j].value) < 0.05);
+          j++;
+          return true;
+        });
+    CHECK(num == n);
+  }
+  const double bin_ns = (hub_test_now_us() - start) * 1000 / NUM_ITER / n;
+
+  printf("%4d points: JSON %6d bytes, %4.0f ns/point; "
+         "binary %5d bytes (%d base64), %4.0f ns/point\n",
+         n, (int) json.size(), json_ns, (int) bin.size(), (int) b64_size,
+         bin_ns);
+  CHECK(b64_size * 4 < json.size());
+}
+
+static void test_invalid(void) {
+  std::string bin;
+  hub_data_bin_encode(make_points(10), 1, &bin);
+  // Truncated batch is rejected before any point is passed on.
+  int calls = 0;
+  CHECK(hub_data_bin_decode((const uint8_t *) bin.data(), bin.size() - 1,
+                            [&calls](const SensorData &) {
+                              calls++;
+                              return true;
+                            }) == -1);
+  CHECK(calls == 0);
+  // Stops when the callback says so.
+  CHECK(hub_data_bin_decode((const uint8_t *) bin.data(), bin.size(),
+                            [&calls](const SensorData &) {
+                              return ++calls < 3;
+                            }) == 2);
+  CHECK(calls == 3);
+}
+
+int main(void) {
+  test_invalid();
+  bench(10);
+  bench(100);
+  bench(1000);
+  return 0;
+}
@@ -0,0 +1,73 @@
+// SensorTable vs std::map lookup and insertion at various table sizes.
+
+#include <map>
+#include <vector>
+
+#include "hub_data_table.hpp"
+#include "hub_test.hpp"
+
+#define NUM_LOOKUPS 1000000
+
+// Names are not used here, hub_names.cpp needs mgos.
+const char *hub_name_get(uint16_t id) {
+  (void) id;
+  return "";
+}
+
+static std::vector<uint64_t> make_keys(int n) {
+  std::vector<uint64_t> keys;
+  srand(n);
+  for (int i = 0; i < n; i++) {
+    keys.push_back(SensorData::MakeKey(rand() % 100000, rand() % 4));
+  }
+  return keys;
+}
+
+static void bench(int n) {
+  const std::vector<uint64_t> keys = make_keys(n);
+  std::vector<uint64_t> lookups;
+  for (int i = 0; i < NUM_LOOKUPS; i++) {
+    lookups.push_back(keys[rand() % keys.size()]);
+  }
+
+  double start = hub_test_now_us();
+  SensorTable table;
+  for (uint64_t key : keys) {
+    bool inserted;
+    table.FindOrInsert(key, &inserted)->value = key;
+  }
+  const double table_insert_us = hub_test_now_us() - start;
+  start = hub_test_now_us();
+  double sum = 0;
+  for (uint64_t key : lookups) sum += table.Find(key)->value;
+  const double table_find_us = hub_test_now_us() - start;
+
+  start = hub_test_now_us();
+  std::map<uint64_t, SensorData> map;
+  for (uint64_t key : keys) map[key].value = key;
+  const double map_insert_us = hub_test_now_us() - start;
+  start = hub_test_now_us();
+  double map_sum = 0;
+  for (uint64_t key : lookups) map_sum += map.find(key)->second.value;
+  const double map_find_us = hub_test_now_us() - start;
+
+  CHECK(table.size() == map.size());
+  CHECK(sum == map_sum);
+  auto mit = map.begin();
+  for (const SensorData &sd : table) {
+    CHECK(mit != map.end() && mit->first == (uint64_t) sd.value);
+    mit++;
+  }
+  printf("%4d sensors: find %5.1f ns (map %5.1f), "
+         "insert %6.1f ns (map %6.1f)\n",
+         n, table_find_us * 1000 / NUM_LOOKUPS,
+         map_find_us * 1000 / NUM_LOOKUPS, table_insert_us * 1000 / n,
+         map_insert_us * 1000 / n);
+}
+
+int main(void) {
+  bench(50);
+  bench(500);
+  bench(5000);
+  return 0;
+}
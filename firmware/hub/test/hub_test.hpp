@@ -0,0 +1,22 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+// Aborts the test if the condition does not hold.
+#define CHECK(cond)                                                     \
+  do {                                                                  \
+    if (!(cond)) {                                                      \
+      fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, \
+              #cond);                                                   \
+      abort();                                                          \
+    }                                                                   \
+  } while (0)
+
+static inline double hub_test_now_us(void) {
+  using namespace std::chrono;
+  return duration_cast<duration<double, std::micro>>(
+             steady_clock::now().time_since_epoch())
+      .count();
+}
@@ -0,0 +1,91 @@
+// Sensor.DataMulti walker: decoding and linear scaling with batch size.
+
+#include <string>
+#include <vector>
+
+#include "hub_data_multi.hpp"
+#include "hub_test.hpp"
+
+static std::vector<DataPoint> walk(const std::string &data, int *n) {
+  std::vector<DataPoint> points;
+  *n = hub_data_multi_walk(data.data(), data.size(), [&](const DataPoint &dp) {
+    points.push_back(dp);
+    return dp.sid >= 0;
+  });
+  return points;
+}
+
+static void test_decode(void) {
+  int n;
+  std::vector<DataPoint> points = walk(
+      "[{sid: 1, subid: 2, ts: 1600000000.5, v: 21.5, name: \"Hall\"},"
+      " {\"sid\": 3, \"v\": -1, \"rssi\": -70, \"pc\": 5,"
+      "  \"meta\": {\"sid\": 99, \"fw\": [1, 2]}, \"tags\": [\"a\"]},"
+      " {sid: 4, v: 1e3, extra: null, ok: true}]",
+      &n);
+  CHECK(n == 3);
+  CHECK(points.size() == 3);
+  CHECK(points[0].sid == 1 && points[0].subid == 2);
+  CHECK(points[0].ts == 1600000000.5 && points[0].value == 21.5);
+  CHECK(points[0].name.type == JSON_TYPE_STRING);
+  CHECK(std::string(points[0].name.ptr, points[0].name.len) == "Hall");
+  // Nested fields are ignored and do not clobber the point.
+  CHECK(points[1].sid == 3 && points[1].subid == 0 && points[1].value == -1);
+  CHECK(points[1].rssi == -70 && points[1].pc == 5);
+  CHECK(std::isnan(points[1].ts));
+  CHECK(points[1].name.type == JSON_TYPE_INVALID);
+  CHECK(points[2].sid == 4 && points[2].value == 1000);
+  CHECK(points[2].pc == HUB_DEDUP_NO_PC && points[2].rssi == HUB_DEDUP_NO_RSSI);
+}
+
+static void test_invalid(void) {
+  int n;
+  // Walk stops at the first element that is rejected.
+  std::vector<DataPoint> points =
+      walk("[{sid: 1, v: 1}, 5, {sid: 2, v: 2}]", &n);
+  CHECK(n == 1);
+  CHECK(points.size() == 2);
+  CHECK(points[1].sid == -1);
+  points = walk("[[1, 2], {sid: 2, v: 2}]", &n);
+  CHECK(n == 0);
+  CHECK(points.size() == 1 && points[0].sid == -1);
+  points = walk("[]", &n);
+  CHECK(n == 0 && points.empty());
+}
+
+static double bench(int n) {
+  std::string data = "[";
+  for (int i = 0; i < n; i++) {
+    char buf[100];
+    snprintf(buf, sizeof(buf), "%s{sid: %d, subid: 0, ts: %.3f, v: %.1f}",
+             (i > 0 ? ", " : ""), 1000 + i, 1600000000.0 + i, i * 0.1);
+    data += buf;
+  }
+  data += "]";
+  const int iter = 1000000 / n;
+  double sum = 0;
+  const double start = hub_test_now_us();
+  for (int i = 0; i < iter; i++) {
+    int num = hub_data_multi_walk(data.data(), data.size(),
+                                  [&sum](const DataPoint &dp) {
+                                    sum += dp.value;
+                                    return true;
+                                  });
+    CHECK(num == n);
+  }
+  const double ns = (hub_test_now_us() - start) * 1000 / iter / n;
+  CHECK(sum > 0 || n == 1);
+  printf("%4d points: %.0f ns/point\n", n, ns);
+  return ns;
+}
+
+int main(void) {
+  test_decode();
+  test_invalid();
+  const double ns10 = bench(10);
+  bench(100);
+  const double ns1000 = bench(1000);
+  // Single pass: cost per point does not grow with the batch.
+  CHECK(ns1000 < ns10 * 3);
+  return 0;
+}
@@ -0,0 +1,84 @@
+// NamePool IDs, lookups and memory use.
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "hub_name_pool.hpp"
+#include "hub_test.hpp"
+
+#define MAX_SIZE 4096
+#define NUM_KEYS 150
+
+static uint16_t intern(NamePool *pool, const std::string &name) {
+  uint16_t id = pool->Find(name.data(), name.size());
+  if (id != HUB_NAME_NONE) return id;
+  return pool->Add(name.data(), name.size(), MAX_SIZE);
+}
+
+static void test_ids(void) {
+  NamePool pool;
+  CHECK(pool.size() == 1);
+  CHECK(strcmp(pool.Get(HUB_NAME_NONE), "") == 0);
+  CHECK(pool.Find("", 0) == HUB_NAME_NONE);
+  CHECK(pool.Find("x", 1) == HUB_NAME_NONE);
+
+  std::vector<const char *> ptrs;
+  for (int i = 0; i < NUM_KEYS; i++) {
+    std::string name = "Sensor " + std::to_string(i);
+    uint16_t id = intern(&pool, name);
+    CHECK(id == i + 1);
+    ptrs.push_back(pool.Get(id));
+  }
+  for (int i = 0; i < NUM_KEYS; i++) {
+    std::string name = "Sensor " + std::to_string(i);
+    CHECK(intern(&pool, name) == i + 1);
+    // Not moved by growth of the index or new chunks.
+    CHECK(pool.Get(i + 1) == ptrs[i]);
+    CHECK(name == ptrs[i]);
+  }
+  // Prefix of an existing name is a different name.
+  CHECK(pool.Find("Sensor 1", 7) == HUB_NAME_NONE);
+  CHECK(strcmp(pool.Get(NUM_KEYS + 1), "") == 0);
+  CHECK(pool.size() == NUM_KEYS + 1);
+}
+
+static void test_full(void) {
+  NamePool pool;
+  const std::string name(100, 'x');
+  int n = 0;
+  while (pool.Add(name.data(), name.size(), MAX_SIZE) != HUB_NAME_NONE) n++;
+  // Two names per 256-byte chunk.
+  CHECK(n == MAX_SIZE / 256 * 2);
+  CHECK(pool.mem_used() == MAX_SIZE);
+  CHECK(pool.Add(name.data(), name.size(), MAX_SIZE * 2) != HUB_NAME_NONE);
+}
+
+static void bench(void) {
+  NamePool pool;
+  std::vector<std::string> names;
+  for (int i = 0; i < NUM_KEYS; i++) {
+    names.push_back("Living room sensor " + std::to_string(i));
+    intern(&pool, names.back());
+  }
+  const int n = 1000000;
+  double start = hub_test_now_us();
+  unsigned int sum = 0;
+  for (int i = 0; i < n; i++) sum += intern(&pool, names[i % NUM_KEYS]);
+  const double us = hub_test_now_us() - start;
+  CHECK(sum > 0);
+  // Per-record std::string: the object plus a heap block for longer names.
+  size_t strings = 0;
+  for (const std::string &s : names) {
+    strings += sizeof(std::string) + (s.size() > 15 ? s.size() + 1 : 0);
+  }
+  printf("%d names: %d bytes pooled (%d as strings), intern %.0f ns\n",
+         NUM_KEYS, (int) pool.mem_used(), (int) strings, us * 1000 / n);
+}
+
+int main(void) {
+  test_ids();
+  test_full();
+  bench();
+  return 0;
+}
@@ -0,0 +1,99 @@
+// TSBlock round-trip, compression ratio and encode/decode speed.
+
+#include <cmath>
+#include <vector>
+
+#include "hub_test.hpp"
+#include "hub_tsblock.hpp"
+
+#define BLOCK_SIZE 256
+#define NUM_POINTS 100000
+
+struct Point {
+  double ts;
+  double value;
+};
+
+// Slow-moving temperature reported every interval s, with some jitter.
+static std::vector<Point> make_series(int interval, int n) {
+  std::vector<Point> points;
+  double ts = 1600000000, value = 21.5;
+  srand(interval);
+  for (int i = 0; i < n; i++) {
+    ts += interval + (rand() % 10 == 0 ? rand() % 3 - 1 : 0);
+    if (rand() % 4 == 0) value += (rand() % 3 - 1) * 0.1;
+    points.push_back({ts, std::round(value * 10) / 10});
+  }
+  return points;
+}
+
+static std::vector<TSBlock> encode(const std::vector<Point> &points) {
+  std::vector<TSBlock> blocks;
+  for (const Point &p : points) {
+    if (blocks.empty() || !blocks.back().Append(p.ts, p.value)) {
+      blocks.emplace_back(BLOCK_SIZE);
+      CHECK(blocks.back().Append(p.ts, p.value));
+    }
+  }
+  return blocks;
+}
+
+static void test_round_trip(void) {
+  std::vector<Point> points = {
+      {1000, 0}, {1001, 1.5}, {1001, -1.5}, {1100, 1e9},
+      {1101, -0.001}, {5000, 0.001}, {2000000, 42}, {2000001, 42},
+  };
+  std::vector<TSBlock> blocks = encode(points);
+  CHECK(blocks.size() == 1);
+  CHECK(blocks[0].count() == (int) points.size());
+  CHECK(blocks[0].first_ts() == 1000);
+  CHECK(blocks[0].last_ts() == 2000001);
+  TSBlock::Reader r(blocks[0]);
+  double ts, value;
+  for (const Point &p : points) {
+    CHECK(r.Next(&ts, &value));
+    CHECK(ts == p.ts);
+    CHECK(std::fabs(value - p.value) < 0.0005);
+  }
+  CHECK(!r.Next(&ts, &value));
+}
+
+static void bench(int interval) {
+  const std::vector<Point> points = make_series(interval, NUM_POINTS);
+
+  double start = hub_test_now_us();
+  std::vector<TSBlock> blocks = encode(points);
+  const double encode_us = hub_test_now_us() - start;
+
+  size_t mem = 0, i = 0;
+  start = hub_test_now_us();
+  for (const TSBlock &b : blocks) {
+    mem += b.GetMemoryUsage();
+    TSBlock::Reader r(b);
+    double ts, value;
+    while (r.Next(&ts, &value)) {
+      CHECK(ts == points[i].ts);
+      CHECK(std::fabs(value - points[i].value) < 0.0005);
+      i++;
+    }
+  }
+  const double decode_us = hub_test_now_us() - start;
+  CHECK(i == points.size());
+
+  // Raw is a pair of doubles per point.
+  const double ratio = (double) (points.size() * sizeof(Point)) / mem;
+  printf("interval %2d s: %d points in %d blocks, %.1f bytes/point, "
+         "%.1fx vs raw, encode %.0f ns/point, decode %.0f ns/point\n",
+         interval, NUM_POINTS, (int) blocks.size(),
+         (double) mem / points.size(), ratio,
+         encode_us * 1000 / points.size(), decode_us * 1000 / points.size());
+  CHECK(ratio >= 8);
+}
+
+int main(void) {
+  test_round_trip();
+  bench(1);
+  bench(10);
+  bench(60);
+  return 0;
+}
@@ -37,6 +37,25 @@ func addDataHandler(peer string, params json.RawMessage, db *sql.DB) {
 	processSensorData(peer, db, &sd)
 }
 
+type SensorDataMulti struct {
+	Timestamp float64       `json:"ts"`
+	Data      []*SensorData `json:"data"`
+}
+
+func addDataMultiHandler(peer string, params json.RawMessage, db *sql.DB) {
+	var sdm SensorDataMulti
+	if err := json.Unmarshal(params, &sdm); err != nil {
+		glog.Errorf("%s: invalid sensor data: %s", peer, params)
+		return
+	}
+	for _, sd := range sdm.Data {
+		if sd.Timestamp == 0 {
+			sd.Timestamp = sdm.Timestamp
+		}
+		processSensorData(peer, db, sd)
+	}
+}
+
 type ReportTemp struct {
 	SID       int      `json:"sid"`
 	SubID     int      `json:"subid"`
@@ -173,6 +192,8 @@ func (mch *mgRPCConnHandler) Handle(ctx context.Context, jsc *mgrpc.Conn, req *m
 		fallthrough
 	case "Sensor.Data": // Old name
 		addDataHandler(mch.peer, *req.Params, mch.db)
+	case "Sensor.DataMulti":
+		addDataMultiHandler(mch.peer, *req.Params, mch.db)
 	case "Sensor.GetData":
 		resp, err = sensorGetDataHandler(mch.peer, *req.Params, mch.db)
 	default: